@@ -5,6 +5,7 @@
 #include <sstream>
 #include <sys/wait.h>
 #include <iomanip>
+#include <algorithm>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <sys/socket.h>
@@ -13,8 +14,24 @@
 
 #include <dirent.h>
 #include <sys/stat.h>
+#include <spawn.h>
+#include <errno.h>
+#include <glob.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <deque>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <stddef.h>
 
 #include "Commands.h"
+#include "signals.h"
 
 using namespace std;
 
@@ -48,18 +65,71 @@ string _trim(const std::string &s)
     return _rtrim(_ltrim(s));
 }
 
-int _parseCommandLine(const char *cmd_line, char **args)
+static inline bool _isWhitespace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+// Copies the word at src to dst without its quotes, whitespace inside quotes
+// does not end it. Moves src past the word and returns dst past the '\0'.
+static char *_copyWord(const char *&src, char *dst, bool *quoted)
+{
+    *quoted = false;
+    char quote = 0;
+    for (; *src && (quote || !_isWhitespace(*src)); ++src)
+    {
+        if (quote)
+        {
+            if (*src == quote)
+            {
+                quote = 0;
+            }
+            else
+            {
+                *dst++ = *src;
+            }
+        }
+        else if (*src == '\'' || *src == '"')
+        {
+            quote = *src;
+            *quoted = true;
+        }
+        else
+        {
+            *dst++ = *src;
+        }
+    }
+    *dst++ = '\0';
+    return dst;
+}
+
+int _parseCommandLine(const char *cmd_line, char **args, char *arena, bool *quoted, int max_args)
 {
     FUNC_ENTRY()
+    const char *src = cmd_line;
+    char *dst = arena;
     int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;)
+    while (true)
     {
-        args[i] = (char *)malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
+        while (_isWhitespace(*src))
+        {
+            src++;
+        }
+        if (!*src)
+        {
+            break;
+        }
+        if (i == max_args - 1)
+        {
+            args[i] = NULL;
+            return -1;
+        }
+
+        args[i] = dst;
+        dst = _copyWord(src, dst, &quoted[i]);
+        i++;
     }
+    args[i] = NULL;
     return i;
 
     FUNC_EXIT()
@@ -92,65 +162,315 @@ void _removeBackgroundSign(char *cmd_line)
     cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
 }
 
-void removeQuotes(char *args[], int arg_count)
+bool parseSpawnMode(const char *name, SpawnMode *mode)
+{
+    if (strcmp(name, "spawn") == 0 || strcmp(name, "posix_spawn") == 0)
+    {
+        *mode = SPAWN_POSIX;
+    }
+    else if (strcmp(name, "vfork") == 0)
+    {
+        *mode = SPAWN_VFORK;
+    }
+    else if (strcmp(name, "fork") == 0)
+    {
+        *mode = SPAWN_FORK;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+const char *spawnModeName(SpawnMode mode)
+{
+    switch (mode)
+    {
+    case SPAWN_POSIX:
+        return "spawn";
+    case SPAWN_VFORK:
+        return "vfork";
+    default:
+        return "fork";
+    }
+}
+
+static pid_t spawnWithPosixSpawn(const char *path, char *const argv[], bool search_path, int stdout_fd, int stdin_fd)
+{
+    extern char **environ;
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr) != 0)
+    {
+        cerr << "smash error: fork failed" << endl;
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdout_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    }
+    if (stdin_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    }
+
+    // pgroup 0 puts the child in a group of its own, same as setpgrp().
+    // The event loop keeps SIGINT/SIGCHLD blocked in smash, the child must not inherit that.
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, SmallShell::getInstance().events.childSigmask());
+
+    pid_t pid;
+    int res = search_path ? posix_spawnp(&pid, path, &actions, &attr, argv, environ)
+                          : posix_spawn(&pid, path, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (res != 0)
+    {
+        // glibc reports exec errors back to the parent
+        cerr << "smash error: exec failed" << endl;
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t spawnWithVfork(const char *path, char *const argv[], bool search_path, int stdout_fd, int stdin_fd)
 {
-    for (int i = 1; i < arg_count; ++i)
+    // The child shares our memory until it execs, so it can hand the exec error back here
+    volatile int exec_errno = 0;
+    const sigset_t *child_mask = SmallShell::getInstance().events.childSigmask();
+
+    pid_t pid = vfork();
+    if (pid == -1)
     {
-        std::string arg(args[i]);
-        if (arg.size() > 1 && ((arg.front() == '"' && arg.back() == '"') || (arg.front() == '\'' && arg.back() == '\'')))
+        cerr << "smash error: fork failed" << endl;
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        // Child process: only async-signal-safe calls until exec
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, child_mask, nullptr);
+        if (stdout_fd != -1)
+        {
+            dup2(stdout_fd, STDOUT_FILENO);
+        }
+        if (stdin_fd != -1)
+        {
+            dup2(stdin_fd, STDIN_FILENO);
+        }
+        if (search_path)
+        {
+            execvp(path, argv);
+        }
+        else
         {
-            arg = arg.substr(1, arg.size() - 2);
-            strcpy(args[i], arg.c_str());
+            execv(path, argv);
         }
+        exec_errno = errno;
+        _exit(1);
+    }
+
+    if (exec_errno != 0)
+    {
+        waitpid(pid, nullptr, 0);
+        cerr << "smash error: exec failed" << endl;
+        return -1;
     }
+    return pid;
 }
 
-ExternalCommand::ExternalCommand(const char *cmd_line, string &com, bool is_background_command, string &original) : Command(cmd_line), command(com), is_background_command(is_background_command), original_cmd(original) {}
-void ExternalCommand::execute()
+// Moves pid into the cgroup, 0 is the calling process
+static bool _joinCgroup(int cgroup_fd, pid_t pid)
 {
-    cmd_line = command.c_str();
-    removeQuotes(this->args, this->args_count);
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d", (int)pid);
+    int fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    bool joined = fd != -1 && write(fd, buf, len) == len;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    return joined;
+}
 
+static pid_t spawnWithFork(const char *path, char *const argv[], bool search_path, int cgroup_fd, int stdout_fd,
+                           int stdin_fd)
+{
     pid_t pid = fork();
     if (pid == -1)
     {
         cerr << "smash error: fork failed" << endl;
+        return -1;
     }
 
     if (pid == 0)
     {
         // Child process
         setpgrp();
-        if (strchr(cmd_line, '*') || strchr(cmd_line, '?'))
+        SmallShell::getInstance().events.resetInChild();
+        if (cgroup_fd != -1 && !_joinCgroup(cgroup_fd, 0))
         {
-            // Complex command
-            char *bash_args[] = {(char *)"/bin/bash", (char *)"-c", (char *)cmd_line, nullptr};
-            execv("/bin/bash", bash_args);
+            cerr << "smash error: limit: joining the cgroup failed" << endl;
+            exit(1);
+        }
+        if (stdout_fd != -1)
+        {
+            dup2(stdout_fd, STDOUT_FILENO);
+        }
+        if (stdin_fd != -1)
+        {
+            dup2(stdin_fd, STDIN_FILENO);
+        }
+        if (search_path)
+        {
+            execvp(path, argv);
         }
         else
         {
-            // Simple command
-            execvp(args[0], args);
+            execv(path, argv);
         }
         cerr << "smash error: exec failed" << endl;
         exit(1);
     }
-    else
+
+    // Both sides move the child, like setpgid in job control shells, so it
+    // is in the cgroup before the exec and before we return
+    if (cgroup_fd != -1)
+    {
+        _joinCgroup(cgroup_fd, pid);
+    }
+    return pid;
+}
+
+pid_t spawnProcess(const char *path, char *const argv[], bool search_path, SpawnMode mode, int cgroup_fd,
+                   int stdout_fd, int stdin_fd)
+{
+    if (cgroup_fd != -1)
+    {
+        return spawnWithFork(path, argv, search_path, cgroup_fd, stdout_fd, stdin_fd);
+    }
+    switch (mode)
+    {
+    case SPAWN_POSIX:
+        return spawnWithPosixSpawn(path, argv, search_path, stdout_fd, stdin_fd);
+    case SPAWN_VFORK:
+        return spawnWithVfork(path, argv, search_path, stdout_fd, stdin_fd);
+    default:
+        return spawnWithFork(path, argv, search_path, -1, stdout_fd, stdin_fd);
+    }
+}
+
+ExternalCommand::ExternalCommand(const char *cmd_line, string &com, bool is_background_command, string &original) : Command(cmd_line), command(com), is_background_command(is_background_command), original_cmd(original) {}
+static bool _hasWildcard(const char *arg)
+{
+    return strpbrk(arg, "*?[") != nullptr;
+}
+
+// Expands unquoted wildcard arguments with glob(3) into argv, instead of handing the
+// whole line to /bin/bash -c. Patterns that match nothing are kept as they are, like bash does.
+// The expanded strings live in globbuf until the caller calls globfree.
+static void _expandWildcards(char *args[], int args_count, const bool quoted[], vector<char *> &argv, glob_t *globbuf)
+{
+    memset(globbuf, 0, sizeof(*globbuf));
+    bool first_glob = true;
+    for (int i = 0; i < args_count; ++i)
     {
-        // Parent process
-        if (!is_background_command)
+        if (i == 0 || quoted[i] || !_hasWildcard(args[i]))
         {
-            // We should wait for this command to finish. no & at the end.
-            SmallShell &smash = SmallShell::getInstance();
-            smash.fg_pid = pid;
-            waitpid(pid, nullptr, 0);
-            smash.fg_pid = -1;
+            argv.push_back(args[i]);
+            continue;
         }
-        else
+
+        size_t before = globbuf->gl_pathc;
+        int flags = GLOB_NOCHECK | (first_glob ? 0 : GLOB_APPEND);
+        first_glob = false;
+        if (glob(args[i], flags, nullptr, globbuf) != 0)
+        {
+            argv.push_back(args[i]);
+            continue;
+        }
+        for (size_t j = before; j < globbuf->gl_pathc; ++j)
+        {
+            argv.push_back(globbuf->gl_pathv[j]);
+        }
+    }
+    argv.push_back(nullptr);
+}
+
+const char *ExternalCommand::prepareExec(vector<char *> &argv, glob_t *globbuf)
+{
+    cmd_line = command.c_str();
+    _expandWildcards(this->args, this->args_count, this->quoted, argv, globbuf);
+
+    // resolved through the command hash so we know before forking whether it exists at all
+    const char *path = SmallShell::getInstance().command_hash.lookup(args[0]);
+    if (!path)
+    {
+        cerr << "smash error: " << args[0] << ": command not found" << endl;
+    }
+    return path;
+}
+
+void ExternalCommand::execInPlace()
+{
+    vector<char *> argv;
+    glob_t globbuf;
+    const char *path = prepareExec(argv, &globbuf);
+    if (path)
+    {
+        execv(path, argv.data());
+        cerr << "smash error: exec failed" << endl;
+    }
+    exit(1);
+}
+
+pid_t ExternalCommand::spawn(int stdout_fd, int stdin_fd)
+{
+    vector<char *> argv;
+    glob_t globbuf;
+    const char *path = prepareExec(argv, &globbuf);
+    if (!path)
+    {
+        globfree(&globbuf);
+        return -1;
+    }
+    pid_t pid = spawnProcess(path, argv.data(), false, SmallShell::getInstance().spawn_mode, this->cgroup_fd, stdout_fd,
+                             stdin_fd);
+    globfree(&globbuf);
+    return pid;
+}
+
+void ExternalCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    pid_t pid = spawn();
+    if (pid == -1)
+    {
+        smash.last_status = 127;
+        return;
+    }
+
+    if (!is_background_command)
+    {
+        // We should wait for this command to finish. no & at the end.
+        smash.fg_pid = pid;
+        int status;
+        struct rusage usage;
+        if (smash.events.waitChild(pid, &status, 0, &usage) == pid)
         {
-            // in this case, it is added to the jobs list
-            SmallShell::getInstance().jobs.addJob(this, pid, false);
+            smash.setWaitStatus(status);
+            smash.foreground_usage.add(usage);
         }
+        smash.fg_pid = -1;
+    }
+    else
+    {
+        // in this case, it is added to the jobs list
+        smash.jobs.addJob(this, pid, false, this->cgroup);
     }
 }
 
@@ -165,6 +485,7 @@ void QuitCommand::execute()
     {
         this->jobs->killAllJobs();
     }
+    this->jobs->releaseCgroups();
 
     exit(0);
 }
@@ -208,7 +529,7 @@ void KillCommand::execute()
     }
 
     std::cout << "signal number " << signum << " was sent to pid " << job->pid << std::endl;
-    if (kill(job->pid, signum) == -1)
+    if (job->sendSignal(signum) == -1)
     {
         cerr << "smash error: kill failed" << endl;
         return;
@@ -222,43 +543,212 @@ void KillCommand::execute()
 
 AliasCommand::AliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
 UnAliasCommand::UnAliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+#define ALIAS_SLOT_EMPTY (-1)
+#define ALIAS_SLOT_TOMBSTONE (-2)
+
+AliasStore::AliasStore() : index(16, ALIAS_SLOT_EMPTY), live(0), used_slots(0) {}
+
+static bool _isAliasNameChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Hand-written form of ^alias ([a-zA-Z0-9_]+)='([^']*)'$
+bool AliasStore::parseDefinition(const char *line, size_t length, string &name, string &value)
+{
+    const char prefix[] = "alias ";
+    size_t prefix_length = sizeof(prefix) - 1;
+    if (length < prefix_length || memcmp(line, prefix, prefix_length) != 0)
+    {
+        return false;
+    }
+
+    size_t pos = prefix_length;
+    size_t name_start = pos;
+    while (pos < length && _isAliasNameChar(line[pos]))
+    {
+        pos++;
+    }
+    size_t name_end = pos;
+    if (name_end == name_start || pos + 2 > length || line[pos] != '=' || line[pos + 1] != '\'')
+    {
+        return false;
+    }
+
+    size_t value_start = pos + 2;
+    const char *quote = (const char *)memchr(line + value_start, '\'', length - value_start);
+    // the closing quote has to be the last character
+    if (!quote || (size_t)(quote - line) != length - 1)
+    {
+        return false;
+    }
+
+    name.assign(line + name_start, name_end - name_start);
+    value.assign(line + value_start, length - 1 - value_start);
+    return true;
+}
+
+size_t AliasStore::hash(const char *name, size_t length)
+{
+    // FNV-1a
+    size_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i)
+    {
+        h = (h ^ (unsigned char)name[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+int AliasStore::findSlot(const char *name, size_t length) const
+{
+    size_t mask = this->index.size() - 1;
+    for (size_t slot = hash(name, length) & mask;; slot = (slot + 1) & mask)
+    {
+        int entry = this->index[slot];
+        if (entry == ALIAS_SLOT_EMPTY)
+        {
+            return -1;
+        }
+        if (entry != ALIAS_SLOT_TOMBSTONE)
+        {
+            const string &entry_name = this->list[entry].name;
+            if (entry_name.size() == length && memcmp(entry_name.data(), name, length) == 0)
+            {
+                return slot;
+            }
+        }
+    }
+}
+
+void AliasStore::rebuild(size_t capacity)
+{
+    // drop removed entries, the order of the live ones does not change
+    size_t kept = 0;
+    for (size_t i = 0; i < this->list.size(); ++i)
+    {
+        if (this->list[i].alive)
+        {
+            if (kept != i)
+            {
+                this->list[kept] = std::move(this->list[i]);
+            }
+            kept++;
+        }
+    }
+    this->list.resize(kept, AliasEntry("", ""));
+
+    size_t size = 16;
+    while (size < capacity * 2)
+    {
+        size *= 2;
+    }
+    this->index.assign(size, ALIAS_SLOT_EMPTY);
+    size_t mask = size - 1;
+    for (size_t i = 0; i < this->list.size(); ++i)
+    {
+        size_t slot = hash(this->list[i].name.data(), this->list[i].name.size()) & mask;
+        while (this->index[slot] != ALIAS_SLOT_EMPTY)
+        {
+            slot = (slot + 1) & mask;
+        }
+        this->index[slot] = i;
+    }
+    this->used_slots = this->live;
+}
+
+void AliasStore::reserve(size_t count)
+{
+    this->list.reserve(count);
+    if (count * 2 > this->index.size())
+    {
+        rebuild(count);
+    }
+}
+
+bool AliasStore::add(const string &name, const string &value)
+{
+    if (findSlot(name.data(), name.size()) != -1)
+    {
+        return false;
+    }
+
+    // keep the table at most half full, counting tombstones
+    if ((this->used_slots + 1) * 2 > this->index.size())
+    {
+        rebuild(this->live + 1);
+    }
+
+    size_t mask = this->index.size() - 1;
+    size_t slot = hash(name.data(), name.size()) & mask;
+    while (this->index[slot] >= 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    if (this->index[slot] == ALIAS_SLOT_EMPTY)
+    {
+        this->used_slots++;
+    }
+    this->index[slot] = this->list.size();
+    this->list.emplace_back(name, value);
+    this->live++;
+    return true;
+}
+
+bool AliasStore::remove(const char *name)
+{
+    int slot = findSlot(name, strlen(name));
+    if (slot == -1)
+    {
+        return false;
+    }
+    AliasEntry &entry = this->list[this->index[slot]];
+    entry.alive = false;
+    entry.name.clear();
+    entry.value.clear();
+    this->index[slot] = ALIAS_SLOT_TOMBSTONE;
+    this->live--;
+
+    if (this->list.size() - this->live > this->live)
+    {
+        rebuild(this->live);
+    }
+    return true;
+}
+
+const string *AliasStore::find(const char *name, size_t length) const
+{
+    int slot = findSlot(name, length);
+    return slot == -1 ? nullptr : &this->list[this->index[slot]].value;
+}
+
 void AliasCommand::execute()
 {
     SmallShell &smash = SmallShell::getInstance();
-    auto &aliases = smash.getAliasesMap();
-    auto &alias_list = smash.getAliases();
-
-    // Regex to validate the alias format
-    std::regex alias_regex("^alias ([a-zA-Z0-9_]+)='([^']*)'$");
-    std::smatch match;
+    AliasStore &aliases = smash.getAliases();
 
     if (this->args_count == 1)
     {
         // list all
-        for (const auto &entry : alias_list)
+        for (const auto &entry : aliases.entries())
         {
-            std::cout << entry.first << "='" << entry.second << "'" << std::endl;
+            if (entry.alive)
+            {
+                std::cout << entry.name << "='" << entry.value << "'" << std::endl;
+            }
         }
         return;
     }
 
     // make a new alias
     string input = _trim(string(cmd_line));
-    if (std::regex_match(input, match, alias_regex))
+    string name, command;
+    if (AliasStore::parseDefinition(input.data(), input.size(), name, command))
     {
-        string name = match[1];    // alias name
-        string command = match[2]; // command
-
         // Check if name is a reserved keyword or existing alias
-        if (aliases.find(name) != aliases.end() || smash.isReservedCommand(name))
+        if (smash.isReservedCommand(name) || !aliases.add(name, command))
         {
             std::cerr << "smash error: alias: " << name << " already exists or is a reserved command" << std::endl;
-            return;
         }
-
-        // save
-        aliases[name] = command;
-        alias_list.emplace_back(name, command);
     }
     else
     {
@@ -269,9 +759,7 @@ void AliasCommand::execute()
 // unalias command (built in command)
 void UnAliasCommand::execute()
 {
-    SmallShell &smash = SmallShell::getInstance();
-    auto &aliases = smash.getAliasesMap();
-    auto &aliases_list = smash.getAliases();
+    AliasStore &aliases = SmallShell::getInstance().getAliases();
 
     // no arguments provided
     if (args_count == 1)
@@ -283,19 +771,11 @@ void UnAliasCommand::execute()
     // Iterate through the provided alias names
     for (int i = 1; i < args_count; i++)
     {
-        string alias_name(args[i]);
-
-        // Check if the alias exists
-        if (aliases.find(alias_name) == aliases.end())
+        if (!aliases.remove(args[i]))
         {
-            std::cerr << "smash error: unalias: " << alias_name << " alias does not exist" << std::endl;
+            std::cerr << "smash error: unalias: " << args[i] << " alias does not exist" << std::endl;
             return;
         }
-
-        // Remove
-        aliases.erase(alias_name);
-        aliases_list.remove_if([&alias_name](const std::pair<std::string, std::string> &alias)
-                               { return alias.first == alias_name; });
     }
 }
 
@@ -342,41 +822,220 @@ void RedirectionCommand::execute()
     close(temp_stdout_fd);
 }
 
-// Reads a line from the given file descriptor into the buffer, up to max_len characters.
-// Returns the number of characters read, or -1 on error.
-static ssize_t readLine(int fileDescriptor, char *outputBuffer, size_t maxLength)
+LineReader::LineReader(const char *path, char delim)
+    : fd(::open(path, O_RDONLY | O_CLOEXEC)), delim(delim), buf(nullptr), cap(LINE_READER_SIZE),
+      start(0), end(0), eof(false), error(false)
 {
-    size_t currentIndex = 0; // Tracks the current position in the buffer
-    char currentChar;        // Temporary storage for the character being read
+    if (this->fd != -1)
+    {
+        // One spare byte so the last unterminated line can still get its '\0'
+        this->buf = (char *)malloc(this->cap + 1);
+    }
+}
 
-    // Loop until the buffer is full or a newline/EOF is encountered
-    while (currentIndex < maxLength - 1)
+LineReader::~LineReader()
+{
+    if (this->fd != -1)
     {
-        ssize_t bytesRead = read(fileDescriptor, &currentChar, 1); // Read one character at a time
-        if (bytesRead < 0)
-        {
-            // Error occurred during read
-            perror("smash error: read failed");
-            return -1;
-        }
-        if (bytesRead == 0)
+        close(this->fd);
+    }
+    free(this->buf);
+}
+
+bool LineReader::next(const char *&line, size_t &len)
+{
+    if (this->fd == -1 || !this->buf)
+    {
+        return false;
+    }
+    while (true)
+    {
+        char *begin = this->buf + this->start;
+        char *hit = (char *)memchr(begin, this->delim, this->end - this->start);
+        if (hit)
         {
-            // End of file (EOF) reached
-            break;
+            *hit = '\0';
+            line = begin;
+            len = hit - begin;
+            this->start = hit - this->buf + 1;
+            return true;
         }
-        if (currentChar == '\n')
+        if (this->eof || this->error)
         {
-            // Newline character indicates the end of the line
-            outputBuffer[currentIndex++] = currentChar;
-            break;
+            if (this->start == this->end)
+            {
+                return false;
+            }
+            this->buf[this->end] = '\0';
+            line = begin;
+            len = this->end - this->start;
+            this->start = this->end;
+            return true;
+        }
+
+        // Keep the partial line at the front and refill behind it
+        if (this->start > 0)
+        {
+            memmove(this->buf, begin, this->end - this->start);
+            this->end -= this->start;
+            this->start = 0;
+        }
+        if (this->end == this->cap)
+        {
+            char *grown = (char *)realloc(this->buf, this->cap * 2 + 1);
+            if (!grown)
+            {
+                perror("smash error: realloc failed");
+                this->error = true;
+                continue;
+            }
+            this->buf = grown;
+            this->cap *= 2;
+        }
+        ssize_t bytes = read(this->fd, this->buf + this->end, this->cap - this->end);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("smash error: read failed");
+            this->error = true;
+        }
+        else if (bytes == 0)
+        {
+            this->eof = true;
+        }
+        else
+        {
+            this->end += bytes;
+        }
+    }
+}
+
+template <class T>
+static Command *_makeBuiltin(const char *cmd_line, SmallShell &)
+{
+    return new T(cmd_line);
+}
+
+template <class T>
+static Command *_makeJobsBuiltin(const char *cmd_line, SmallShell &smash)
+{
+    return new T(cmd_line, &smash.jobs);
+}
+
+static Command *_makeChangeDir(const char *cmd_line, SmallShell &smash)
+{
+    return new ChangeDirCommand(cmd_line, smash.getPlastPwd());
+}
+
+// Every builtin, sorted by name. Adding a builtin is one line here.
+static constexpr BuiltinEntry builtins[] = {
+    {"alias", _makeBuiltin<AliasCommand>, false, false},
+    {"cd", _makeChangeDir, false, false},
+    {"chprompt", _makeBuiltin<ChpromptCommand>, false, false},
+    {"du", _makeBuiltin<DuCommand>, false, false},
+    {"fg", _makeJobsBuiltin<ForegroundCommand>, false, false},
+    {"hash", _makeBuiltin<HashCommand>, false, false},
+    {"jobq", _makeJobsBuiltin<JobQueueCommand>, true, false},
+    {"jobs", _makeJobsBuiltin<JobsCommand>, false, false},
+    {"kill", _makeJobsBuiltin<KillCommand>, false, false},
+    {"limit", _makeBuiltin<LimitCommand>, true, true},
+    {"netinfo", _makeBuiltin<NetInfo>, false, false},
+    {"parallel", _makeBuiltin<ParallelCommand>, false, false},
+    {"pipesize", _makeBuiltin<PipeSizeCommand>, false, false},
+    {"procmon", _makeBuiltin<ProcMonCommand>, false, false},
+    {"pwd", _makeBuiltin<PwdCommand>, false, false},
+    {"quit", _makeJobsBuiltin<QuitCommand>, false, false},
+    {"showpid", _makeBuiltin<ShowPidCommand>, false, false},
+    {"time", _makeBuiltin<TimeCommand>, true, false},
+    {"unalias", _makeBuiltin<UnAliasCommand>, false, false},
+    {"unsetenv", _makeBuiltin<UnSetEnvCommand>, false, false},
+    {"watchproc", _makeBuiltin<WatchProcCommand>, false, false},
+    {"whoami", _makeBuiltin<WhoAmICommand>, false, false},
+};
+static constexpr size_t builtins_count = sizeof(builtins) / sizeof(builtins[0]);
+
+static constexpr bool _nameLess(const char *a, const char *b)
+{
+    return *a == *b ? (*a != '\0' && _nameLess(a + 1, b + 1)) : (unsigned char)*a < (unsigned char)*b;
+}
+
+static constexpr bool _builtinsSorted(const BuiltinEntry *table, size_t count)
+{
+    return count < 2 || (_nameLess(table[0].name, table[1].name) && _builtinsSorted(table + 1, count - 1));
+}
+
+static_assert(_builtinsSorted(builtins, builtins_count), "builtins table must stay sorted by name");
+
+const BuiltinEntry *findBuiltin(const char *name)
+{
+    size_t low = 0, high = builtins_count;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        int cmp = strcmp(name, builtins[mid].name);
+        if (cmp == 0)
+        {
+            return &builtins[mid];
+        }
+        if (cmp < 0)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return nullptr;
+}
+
+// Splits a command line on | and |& outside of quotes.
+// Returns false if there is no pipe in the line.
+static bool _splitPipeline(const string &cmd_s, vector<string> &stages, vector<bool> &stderr_pipes)
+{
+    char quote = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < cmd_s.size(); ++i)
+    {
+        char c = cmd_s[i];
+        if (quote)
+        {
+            if (c == quote)
+            {
+                quote = 0;
+            }
+            continue;
+        }
+        if (c == '\'' || c == '"')
+        {
+            quote = c;
+            continue;
+        }
+        if (c != '|')
+        {
+            continue;
+        }
+
+        bool is_stderr = (i + 1 < cmd_s.size() && cmd_s[i + 1] == '&');
+        stages.push_back(_trim(cmd_s.substr(start, i - start)));
+        stderr_pipes.push_back(is_stderr);
+        if (is_stderr)
+        {
+            i++;
         }
-        // Store the character in the buffer
-        outputBuffer[currentIndex++] = currentChar;
+        start = i + 1;
     }
 
-    // Null-terminate the string
-    outputBuffer[currentIndex] = '\0';
-    return (ssize_t)currentIndex; // Return the number of characters read
+    if (stages.empty())
+    {
+        return false;
+    }
+    stages.push_back(_trim(cmd_s.substr(start)));
+    stderr_pipes.push_back(false);
+    return true;
 }
 
 Command *SmallShell::CreateCommand(const char *cmd_line)
@@ -395,33 +1054,33 @@ Command *SmallShell::CreateCommand(const char *cmd_line)
     string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
     firstWord = _trim(firstWord);
 
-    auto &aliases = smash.getAliasesMap();
-    auto aliasIter = aliases.find(firstWord);
-    if (aliasIter != aliases.end())
+    const string *alias = smash.getAliases().find(firstWord.data(), firstWord.size());
+    if (alias)
     {
         // Expand the alias
-        cmd_s = _trim(aliasIter->second + cmd_s.substr(firstWord.size()));
+        cmd_s = _trim(*alias + cmd_s.substr(firstWord.size()));
         firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
         cmd_line = strdup(cmd_s.c_str());
     }
 
-    // Pipe logic
-    size_t pipe_position = cmd_s.find("|&");
-    bool is_stderr_redirect = (pipe_position != string::npos);
-
-    if (!is_stderr_redirect)
+    const BuiltinEntry *builtin = findBuiltin(firstWord.c_str());
+    if (builtin && builtin->whole_line)
     {
-        pipe_position = cmd_s.find('|');
+        return builtin->factory(cmd_line, *this);
     }
 
-    if (pipe_position != string::npos)
+    // Pipe logic
+    vector<string> stages;
+    vector<bool> stderr_pipes;
+    if (_splitPipeline(cmd_s, stages, stderr_pipes))
     {
-        // Split the command into two parts
-        std::string first_command = _trim(cmd_s.substr(0, pipe_position));
-        std::string second_command = _trim(cmd_s.substr(pipe_position + (is_stderr_redirect ? 2 : 1)));
-
-        // Return a PipeCommand object
-        return new PipeCommand(cmd_line, first_command, second_command, is_stderr_redirect);
+        bool is_background_pipeline = _isBackgroundComamnd(cmd_s.c_str());
+        if (is_background_pipeline)
+        {
+            _removeBackgroundSign(const_cast<char *>(stages.back().c_str()));
+            stages.back() = _trim(stages.back().c_str());
+        }
+        return new PipeCommand(cmd_line, stages, stderr_pipes, is_background_pipeline);
     }
 
     bool is_background_command = _isBackgroundComamnd(cmd_line);
@@ -441,98 +1100,259 @@ Command *SmallShell::CreateCommand(const char *cmd_line)
         return new RedirectionCommand(cmd_line, command, output_file, append);
     }
 
-    if (firstWord.compare("alias") == 0)
+    if (builtin)
     {
-        return new AliasCommand(cmd_line);
+        return builtin->factory(cmd_line, *this);
     }
 
-    if (firstWord.compare("jobs") == 0)
+    string updated_str_after_aliases(cmd_line);
+    return new ExternalCommand(cmd_line, updated_str_after_aliases, is_background_command, org_cmd_line);
+}
+
+void SmallShell::executeCommand(const char *cmd_line)
+{
+    // TODO: Add your implementation here
+    // for example:
+    Command *cmd = CreateCommand(cmd_line);
+    if (cmd)
     {
-        return new JobsCommand(cmd_line, &jobs);
+        // builtins leave it at 0, external commands overwrite it when they are reaped
+        this->last_status = 0;
+        cmd->execute();
+        delete cmd;
     }
 
-    if (firstWord.compare("fg") == 0)
+    // Please note that you must fork smash process for some commands (e.g., external commands....)
+}
+
+MappedFile::~MappedFile()
+{
+    if (this->data && this->size > 0)
     {
-        return new ForegroundCommand(cmd_line, &jobs);
+        munmap((void *)this->data, this->size);
     }
-    if (firstWord.compare("quit") == 0)
+}
+
+bool MappedFile::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
     {
-        return new QuitCommand(cmd_line, &jobs);
+        return false;
     }
-    if (firstWord.compare("kill") == 0)
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) == -1)
     {
-        return new KillCommand(cmd_line, &jobs);
+        close(fd);
+        return false;
     }
-    if (firstWord.compare("chprompt") == 0)
+    this->size = stat_buf.st_size;
+    if (this->size == 0)
     {
-        return new ChpromptCommand(cmd_line);
+        // mmap refuses empty files, an empty buffer is just as good
+        close(fd);
+        this->data = "";
+        return true;
     }
-    if (firstWord.compare("showpid") == 0)
+    void *mapped = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
     {
-        return new ShowPidCommand(cmd_line);
+        this->size = 0;
+        return false;
     }
-    if (firstWord.compare("unalias") == 0)
+    this->data = (const char *)mapped;
+    return true;
+}
+
+void SmallShell::setWaitStatus(int status)
+{
+    if (WIFEXITED(status))
     {
-        return new UnAliasCommand(cmd_line);
+        this->last_status = WEXITSTATUS(status);
     }
-    if (firstWord.compare("unsetenv") == 0)
+    else if (WIFSIGNALED(status))
     {
-        return new UnSetEnvCommand(cmd_line);
+        this->last_status = 128 + WTERMSIG(status);
     }
-    if (firstWord.compare("du") == 0)
+}
+
+void SmallShell::runScript(const char *data, size_t size)
+{
+    // split the whole script up front, then run it without any prompt I/O
+    vector<string> lines;
+    const char *end = data + size;
+    while (data < end)
     {
-        return new DuCommand(cmd_line);
+        const char *newline = (const char *)memchr(data, '\n', end - data);
+        const char *line_end = newline ? newline : end;
+        lines.emplace_back(data, line_end - data);
+        data = line_end + 1;
     }
-    if (firstWord.compare("pwd") == 0)
+
+    for (const string &line : lines)
     {
-        return new PwdCommand(cmd_line);
+        this->events.dispatch(0);
+        this->jobs.removeFinishedJobs();
+        this->jobs.startQueued();
+        executeCommand(line.c_str());
     }
-    if (firstWord.compare("cd") == 0)
+
+    // jobq commands still waiting would be lost, start them before exiting
+    this->jobs.waitQueue(false);
+}
+
+static bool _startsWithWord(const char *line, size_t length, const char *word)
+{
+    size_t word_length = strlen(word);
+    return length >= word_length && memcmp(line, word, word_length) == 0 &&
+           (length == word_length || _isWhitespace(line[word_length]));
+}
+
+bool SmallShell::loadRcFile(const char *path)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    MappedFile file;
+    if (!file.open(path))
     {
-        return new ChangeDirCommand(cmd_line, getPlastPwd());
+        return false;
     }
-    if (firstWord.compare("watchproc") == 0)
+
+    // one alias per line is the common case, size the alias index once up front
+    size_t lines = 0;
+    for (const char *p = file.data; (p = (const char *)memchr(p, '\n', file.data + file.size - p)); ++p)
     {
-        return new WatchProcCommand(cmd_line);
+        lines++;
     }
-    if (firstWord.compare("whoami") == 0)
+    this->aliases.reserve(this->aliases.entries().size() + lines + 1);
+
+    size_t entries = 0;
+    string name, value;
+    char *args[COMMAND_MAX_ARGS];
+    bool quoted[COMMAND_MAX_ARGS];
+    char arena[BUF_SIZE];
+    const char *pos = file.data;
+    const char *file_end = file.data + file.size;
+    while (pos < file_end)
     {
-        return new WhoAmICommand(cmd_line);
-    }
+        const char *newline = (const char *)memchr(pos, '\n', file_end - pos);
+        const char *line = pos;
+        const char *line_end = newline ? newline : file_end;
+        pos = line_end + 1;
 
-    if (firstWord.compare("netinfo") == 0)
-    {
-        return new NetInfo(cmd_line);
-    }
+        while (line < line_end && _isWhitespace(*line))
+        {
+            line++;
+        }
+        while (line_end > line && _isWhitespace(line_end[-1]))
+        {
+            line_end--;
+        }
+        size_t length = line_end - line;
+        if (length == 0 || *line == '#')
+        {
+            continue;
+        }
+        entries++;
 
-    string updated_str_after_aliases(cmd_line);
-    return new ExternalCommand(cmd_line, updated_str_after_aliases, is_background_command, org_cmd_line);
-}
+        if (_startsWithWord(line, length, "alias"))
+        {
+            if (!AliasStore::parseDefinition(line, length, name, value))
+            {
+                std::cerr << "smash error: alias: invalid alias format" << std::endl;
+            }
+            else if (isReservedCommand(name) || !this->aliases.add(name, value))
+            {
+                std::cerr << "smash error: alias: " << name << " already exists or is a reserved command" << std::endl;
+            }
+            continue;
+        }
 
-void SmallShell::executeCommand(const char *cmd_line)
-{
-    // TODO: Add your implementation here
-    // for example:
-    Command *cmd = CreateCommand(cmd_line);
-    if (cmd)
-    {
-        cmd->execute();
-        delete cmd;
+        string line_copy(line, length);
+        bool chprompt = _startsWithWord(line, length, "chprompt");
+        if (length < sizeof(arena) && (chprompt || _startsWithWord(line, length, "export")))
+        {
+            int count = _parseCommandLine(line_copy.c_str(), args, arena, quoted, COMMAND_MAX_ARGS);
+            if (count == -1)
+            {
+                std::cerr << "smash error: " << (chprompt ? "chprompt" : "export") << ": too many arguments"
+                          << std::endl;
+                continue;
+            }
+            if (chprompt)
+            {
+                setPrompt(count == 1 ? "smash" : args[1]);
+                continue;
+            }
+            for (int i = 1; i < count; ++i)
+            {
+                char *equals = strchr(args[i], '=');
+                if (!equals || equals == args[i])
+                {
+                    std::cerr << "smash error: export: invalid arguments" << std::endl;
+                    continue;
+                }
+                *equals = '\0';
+                setenv(args[i], equals + 1, 1);
+            }
+            continue;
+        }
+
+        // anything else runs like a typed command
+        executeCommand(line_copy.c_str());
     }
 
-    // Please note that you must fork smash process for some commands (e.g., external commands....)
+    // SMASH_RC_TIMING reports how long startup spent here
+    if (getenv("SMASH_RC_TIMING"))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+        std::ios::fmtflags flags = std::cerr.flags();
+        std::streamsize precision = std::cerr.precision();
+        std::cerr << "smash: loaded " << entries << " entries from " << path << " in " << std::fixed
+                  << std::setprecision(3) << elapsed_ms << " ms" << std::endl;
+        std::cerr.flags(flags);
+        std::cerr.precision(precision);
+    }
+    return true;
 }
 
 void Command::prepare()
 {
-    this->args_count = _parseCommandLine(cmd_line, this->args);
+    char *arena = this->inline_arena;
+    size_t length = strlen(cmd_line);
+    if (length >= sizeof(this->inline_arena))
+    {
+        this->heap_arena = (char *)malloc(length + 1);
+        arena = this->heap_arena;
+    }
+    // every word takes a char and a separator, so this many slots always fit
+    int max_args = (int)(length + 1) / 2 + 1;
+    if (max_args > COMMAND_MAX_ARGS)
+    {
+        this->heap_args = (char **)malloc(max_args * sizeof(char *));
+        this->heap_quoted = (bool *)malloc(max_args * sizeof(bool));
+        this->args = this->heap_args;
+        this->quoted = this->heap_quoted;
+    }
+    else
+    {
+        max_args = COMMAND_MAX_ARGS;
+    }
+    this->args_count = _parseCommandLine(cmd_line, this->args, arena, this->quoted, max_args);
 }
 void Command::cleanup()
 {
-    for (int i = 0; i < this->args_count; ++i)
-    {
-        free(this->args[i]);
-    }
+    free(this->heap_arena);
+    free(this->heap_args);
+    free(this->heap_quoted);
+    this->heap_arena = nullptr;
+    this->heap_args = nullptr;
+    this->heap_quoted = nullptr;
+    this->args = this->inline_args;
+    this->quoted = this->inline_quoted;
 }
 
 void ChpromptCommand::execute()
@@ -550,44 +1370,18 @@ void ChpromptCommand::execute()
 
 bool UnSetEnvCommand::getEnv(const char *env_name)
 {
-    std::string env_name_str(env_name);
-    std::string env_value;
-
-    // Open the /proc/<pid>/environ file
+    // /proc/<pid>/environ holds '\0'-separated NAME=VALUE entries
     std::string environ_path = "/proc/" + std::to_string(getpid()) + "/environ";
-    int environ_fd = open(environ_path.c_str(), O_RDONLY);
-    if (environ_fd == -1)
-    {
-        return false;
-    }
-
-    char buffer[BUF_SIZE];
-    ssize_t bytes_read = 0;
-    std::string leftover_data;
+    LineReader reader(environ_path.c_str(), '\0');
+    size_t name_len = strlen(env_name);
 
-    while ((bytes_read = readLine(environ_fd, buffer, sizeof(buffer))) > 0)
+    const char *entry;
+    size_t entry_len;
+    while (reader.next(entry, entry_len))
     {
-        std::string data(buffer, bytes_read);
-        leftover_data += data;
-
-        size_t pos = 0;
-        while ((pos = leftover_data.find('\0')) != std::string::npos)
+        if (entry_len > name_len && entry[name_len] == '=' && memcmp(entry, env_name, name_len) == 0)
         {
-            std::string env_entry = leftover_data.substr(0, pos);
-            leftover_data = leftover_data.substr(pos + 1);
-
-            size_t equal_pos = env_entry.find('=');
-            if (equal_pos != std::string::npos)
-            {
-                std::string key = env_entry.substr(0, equal_pos);
-                std::string value = env_entry.substr(equal_pos + 1);
-
-                if (key == env_name_str)
-                {
-                    env_value = value;
-                    return true;
-                }
-            }
+            return true;
         }
     }
 
@@ -664,83 +1458,236 @@ void PwdCommand::execute()
     }
 }
 
-void WatchProcCommand::execute()
+// Re-reads a /proc file from the start into buf, '\0'-terminated
+static bool _preadProc(int fd, char *buf, size_t size)
 {
-    if (this->args_count != 2)
+    ssize_t bytes;
+    while ((bytes = pread(fd, buf, size - 1, 0)) == -1 && errno == EINTR)
     {
-        cerr << "smash error: watchproc: invalid arguments" << endl;
-        return;
     }
-
-    pid_t pid = std::stoi(this->args[1]);
-    if (kill(pid, 0) == -1)
+    if (bytes <= 0)
     {
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
-        return;
+        return false;
     }
+    buf[bytes] = '\0';
+    return true;
+}
 
-    // Open the /proc/<pid>/stat file to get CPU and memory usage
-    std::string stat_path = "/proc/" + std::to_string(pid) + "/stat";
-    int stat_fd = open(stat_path.c_str(), O_RDONLY);
-    if (stat_fd == -1)
+bool _scanProcStat(const char *line, ProcStat *stat)
+{
+    // The command name may hold spaces and parentheses, count from the last ')'
+    const char *open = strchr(line, '(');
+    const char *close = strrchr(line, ')');
+    if (!open || !close || close < open || close[1] != ' ')
     {
-        // TODO : maybe other msg?
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
-        return;
+        return false;
     }
+    stat->comm = open + 1;
+    stat->comm_len = close - open - 1;
 
-    char stat_buf[BUF_SIZE];
-    ssize_t stat_read = readLine(stat_fd, stat_buf, sizeof(stat_buf));
-    if (stat_read <= 0)
+    long utime = 0;
+    long stime = 0;
+    const char *field = close + 2;
+    for (int index = 3; ; ++index)
     {
-        // TODO : maybe another msg?
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
-        close(stat_fd);
-        return;
+        if (*field == '\0')
+        {
+            return false;
+        }
+        switch (index)
+        {
+        case 3:
+            stat->state = *field;
+            break;
+        case 14:
+            utime = strtol(field, nullptr, 10);
+            break;
+        case 15:
+            stime = strtol(field, nullptr, 10);
+            break;
+        case 22:
+            stat->start_ticks = strtoull(field, nullptr, 10);
+            break;
+        case 24:
+            stat->rss_pages = strtol(field, nullptr, 10);
+            stat->utime = utime;
+            stat->stime = stime;
+            stat->ticks = utime + stime;
+            return true;
+        }
+        field = strchr(field, ' ');
+        if (!field)
+        {
+            return false;
+        }
+        field++;
     }
-    close(stat_fd);
+}
 
-    // Parse the /proc/<pid>/stat file
-    std::istringstream stat_stream(stat_buf);
-    std::string token;
-    std::vector<std::string> stat_fields;
-    while (stat_stream >> token)
+// Lifts the soft RLIMIT_NOFILE to the hard one for builtins that hold many
+// fds at once. Returns false if nothing was changed (no restore needed).
+static bool _raiseFdLimit(struct rlimit *saved_limit)
+{
+    if (getrlimit(RLIMIT_NOFILE, saved_limit) == -1 || saved_limit->rlim_cur >= saved_limit->rlim_max)
     {
-        stat_fields.push_back(token);
+        return false;
     }
+    struct rlimit limit = *saved_limit;
+    limit.rlim_cur = limit.rlim_max;
+    return setrlimit(RLIMIT_NOFILE, &limit) == 0;
+}
 
-    // Ensure we have enough fields
-    if (stat_fields.size() < 24)
+void WatchProcCommand::sample(pid_t pid, long interval_ms, long count)
+{
+    std::string proc_dir = "/proc/" + std::to_string(pid);
+    int stat_fd = open((proc_dir + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+    int statm_fd = open((proc_dir + "/statm").c_str(), O_RDONLY | O_CLOEXEC);
+    char buf[BUF_SIZE];
+    ProcStat fields;
+    if (stat_fd == -1 || statm_fd == -1 || !_preadProc(stat_fd, buf, sizeof(buf)) || !_scanProcStat(buf, &fields))
     {
-        // TODO : make sure need this?
         cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
+        close(stat_fd);
+        close(statm_fd);
         return;
     }
 
-    // Extract CPU usage (utime + stime)
-    long utime = std::stol(stat_fields[13]);
-    long stime = std::stol(stat_fields[14]);
-    long total_time = utime + stime;
-
-    // Get system uptime from /proc/uptime
-    int uptime_fd = open("/proc/uptime", O_RDONLY);
-    if (uptime_fd == -1)
+    long ticks = fields.ticks;
+    SmallShell &smash = SmallShell::getInstance();
+    long hertz = sysconf(_SC_CLK_TCK);
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct timespec last_time;
+    clock_gettime(CLOCK_MONOTONIC, &last_time);
+    for (long printed = 0; count == 0 || printed < count; ++printed)
     {
-        // TODO : make sure err msg
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
-        return;
-    }
+        if (!smash.events.sleepFor(interval_ms))
+        {
+            break;
+        }
 
-    char uptime_buf[BUF_SIZE];
-    ssize_t uptime_read = readLine(uptime_fd, uptime_buf, sizeof(uptime_buf));
-    if (uptime_read <= 0)
-    {
-        // TODO : Make sure err msg
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
-        close(uptime_fd);
+        // Once the process is gone its fds read back ESRCH
+        long resident_pages;
+        if (!_preadProc(stat_fd, buf, sizeof(buf)) || !_scanProcStat(buf, &fields) ||
+            !_preadProc(statm_fd, buf, sizeof(buf)) || sscanf(buf, "%*s %ld", &resident_pages) != 1)
+        {
+            cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
+            break;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = (now.tv_sec - last_time.tv_sec) + (now.tv_nsec - last_time.tv_nsec) / 1e9;
+        double cpu_usage = seconds > 0 ? 100.0 * ((fields.ticks - ticks) / static_cast<double>(hertz)) / seconds : 0;
+        double memory_usage_mb = (resident_pages * page_size) / (1024.0 * 1024.0);
+        ticks = fields.ticks;
+        last_time = now;
+
+        std::cout << "PID: " << pid << " | CPU Usage: " << std::fixed << std::setprecision(1) << cpu_usage
+                  << "% | Memory Usage: " << std::fixed << std::setprecision(1) << memory_usage_mb << " MB" << std::endl;
+    }
+    close(stat_fd);
+    close(statm_fd);
+}
+
+void WatchProcCommand::execute()
+{
+    // watchproc [-i ms] [-n count] pid, either flag turns on sampling
+    long interval_ms = -1;
+    long count = -1;
+    const char *pid_arg = nullptr;
+    bool valid = true;
+    for (int i = 1; valid && i < this->args_count; ++i)
+    {
+        if (strcmp(this->args[i], "-i") == 0 || strcmp(this->args[i], "-n") == 0)
+        {
+            bool is_interval = this->args[i][1] == 'i';
+            char *end = nullptr;
+            long value = i + 1 < this->args_count ? strtol(this->args[i + 1], &end, 10) : -1;
+            valid = end && *end == '\0' && value >= (is_interval ? 1 : 0) && value <= INT_MAX;
+            if (is_interval)
+            {
+                interval_ms = value;
+            }
+            else
+            {
+                count = value;
+            }
+            i++;
+        }
+        else if (!pid_arg)
+        {
+            pid_arg = this->args[i];
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    char *pid_end = nullptr;
+    long pid_value = pid_arg ? strtol(pid_arg, &pid_end, 10) : 0;
+    if (!valid || !pid_arg || *pid_end != '\0' || pid_value <= 0)
+    {
+        cerr << "smash error: watchproc: invalid arguments" << endl;
+        return;
+    }
+
+    pid_t pid = (pid_t)pid_value;
+    if (kill(pid, 0) == -1)
+    {
+        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
+        return;
+    }
+
+    if (interval_ms != -1 || count != -1)
+    {
+        // -n alone samples every second, -i alone until Ctrl-C
+        this->sample(pid, interval_ms == -1 ? 1000 : interval_ms, count == -1 ? 0 : count);
+        return;
+    }
+
+    // Read the /proc/<pid>/stat file to get CPU and memory usage
+    std::string stat_path = "/proc/" + std::to_string(pid) + "/stat";
+    LineReader stat_reader(stat_path.c_str());
+    const char *stat_buf;
+    size_t stat_len;
+    if (!stat_reader.isOpen() || !stat_reader.next(stat_buf, stat_len))
+    {
+        // TODO : maybe other msg?
+        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
+        return;
+    }
+
+    // Parse the /proc/<pid>/stat file
+    std::istringstream stat_stream(stat_buf);
+    std::string token;
+    std::vector<std::string> stat_fields;
+    while (stat_stream >> token)
+    {
+        stat_fields.push_back(token);
+    }
+
+    // Ensure we have enough fields
+    if (stat_fields.size() < 24)
+    {
+        // TODO : make sure need this?
+        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
+        return;
+    }
+
+    // Extract CPU usage (utime + stime)
+    long utime = std::stol(stat_fields[13]);
+    long stime = std::stol(stat_fields[14]);
+    long total_time = utime + stime;
+
+    // Get system uptime from /proc/uptime
+    LineReader uptime_reader("/proc/uptime");
+    const char *uptime_buf;
+    size_t uptime_len;
+    if (!uptime_reader.isOpen() || !uptime_reader.next(uptime_buf, uptime_len))
+    {
+        // TODO : make sure err msg
+        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
         return;
     }
-    close(uptime_fd);
 
     double uptime;
     std::istringstream uptime_stream(uptime_buf);
@@ -753,23 +1700,15 @@ void WatchProcCommand::execute()
 
     // Get memory usage from /proc/<pid>/statm
     std::string statm_path = "/proc/" + std::to_string(pid) + "/statm";
-    int statm_fd = open(statm_path.c_str(), O_RDONLY);
-    if (statm_fd == -1)
+    LineReader statm_reader(statm_path.c_str());
+    const char *statm_buf;
+    size_t statm_len;
+    if (!statm_reader.isOpen() || !statm_reader.next(statm_buf, statm_len))
     {
         cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
         return;
     }
 
-    char statm_buf[BUF_SIZE];
-    ssize_t statm_read = readLine(statm_fd, statm_buf, sizeof(statm_buf));
-    if (statm_read <= 0)
-    {
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
-        close(statm_fd);
-        return;
-    }
-    close(statm_fd);
-
     // Parse memory usage
     std::istringstream statm_stream(statm_buf);
     long resident_pages;
@@ -782,6 +1721,222 @@ void WatchProcCommand::execute()
               << "% | Memory Usage: " << std::fixed << std::setprecision(1) << memory_usage_mb << " MB" << std::endl;
 }
 
+// One row of procmon, the stat fd stays open between refreshes
+struct ProcMonTarget
+{
+    pid_t pid;
+    string label; // the job's command line, or the comm of a plain pid
+    int fd;       // -1 once the process is gone
+    long ticks;
+    unsigned long long start_ticks;
+    double cpu;
+    long rss_pages;
+    char state;
+};
+
+static bool _readTarget(ProcMonTarget &target, char *buf, size_t size, ProcStat *fields)
+{
+    if (target.fd == -1 || !_preadProc(target.fd, buf, size) || !_scanProcStat(buf, fields))
+    {
+        return false;
+    }
+    target.rss_pages = fields->rss_pages;
+    target.state = fields->state;
+    return true;
+}
+
+void ProcMonCommand::execute()
+{
+    bool by_rss = false;
+    long interval_ms = -1;
+    long count = -1;
+    std::vector<pid_t> pids;
+    for (int i = 1; i < this->args_count; ++i)
+    {
+        const char *arg = this->args[i];
+        char *end = nullptr;
+        if (strcmp(arg, "-s") == 0 && i + 1 < this->args_count &&
+            (strcmp(this->args[i + 1], "cpu") == 0 || strcmp(this->args[i + 1], "rss") == 0))
+        {
+            by_rss = strcmp(this->args[++i], "rss") == 0;
+            continue;
+        }
+        if ((strcmp(arg, "-i") == 0 || strcmp(arg, "-n") == 0) && i + 1 < this->args_count)
+        {
+            long value = strtol(this->args[i + 1], &end, 10);
+            bool is_interval = arg[1] == 'i';
+            if (*end == '\0' && value >= (is_interval ? 1 : 0) && value <= INT_MAX)
+            {
+                if (is_interval)
+                {
+                    interval_ms = value;
+                }
+                else
+                {
+                    count = value;
+                }
+                i++;
+                continue;
+            }
+        }
+        long pid = strtol(arg, &end, 10);
+        if (*end != '\0' || pid <= 0)
+        {
+            cerr << "smash error: procmon: invalid arguments" << endl;
+            return;
+        }
+        pids.push_back((pid_t)pid);
+    }
+    bool sampling = interval_ms != -1 || count != -1;
+    if (sampling && interval_ms == -1)
+    {
+        interval_ms = 1000;
+    }
+
+    // Nothing named: every job smash is running
+    SmallShell &smash = SmallShell::getInstance();
+    std::vector<ProcMonTarget> targets;
+    if (pids.empty())
+    {
+        smash.jobs.removeFinishedJobs();
+        for (JobsList::JobEntry *job = smash.jobs.firstJob(); job; job = smash.jobs.nextJob(job))
+        {
+            ProcMonTarget target = {job->pid, job->command, -1, 0, 0, 0, 0, '?'};
+            targets.push_back(target);
+        }
+    }
+    for (size_t i = 0; i < pids.size(); ++i)
+    {
+        ProcMonTarget target = {pids[i], "", -1, 0, 0, 0, 0, '?'};
+        targets.push_back(target);
+    }
+
+    struct rlimit saved_limit;
+    bool raised = _raiseFdLimit(&saved_limit);
+    char buf[BUF_SIZE];
+    char path[64];
+    ProcStat fields;
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        ProcMonTarget &target = targets[i];
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)target.pid);
+        target.fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (!_readTarget(target, buf, sizeof(buf), &fields))
+        {
+            cerr << "smash error: procmon: pid " << target.pid << " does not exist" << endl;
+            if (target.fd != -1)
+            {
+                close(target.fd);
+                target.fd = -1;
+            }
+            continue;
+        }
+        target.ticks = fields.ticks;
+        target.start_ticks = fields.start_ticks;
+        if (target.label.empty())
+        {
+            target.label.assign(fields.comm, fields.comm_len);
+        }
+    }
+
+    long hertz = sysconf(_SC_CLK_TCK);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (!sampling)
+    {
+        // A single table shows the lifetime average, like watchproc
+        double uptime = 0;
+        LineReader uptime_reader("/proc/uptime");
+        const char *line;
+        size_t len;
+        if (uptime_reader.next(line, len))
+        {
+            uptime = strtod(line, nullptr);
+        }
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            double seconds = uptime - targets[i].start_ticks / static_cast<double>(hertz);
+            targets[i].cpu = seconds > 0 ? 100.0 * (targets[i].ticks / static_cast<double>(hertz)) / seconds : 0;
+        }
+        count = 1;
+    }
+
+    struct timespec last_time;
+    clock_gettime(CLOCK_MONOTONIC, &last_time);
+    std::vector<ProcMonTarget *> rows;
+    for (long printed = 0; count == 0 || printed < count; ++printed)
+    {
+        if (sampling)
+        {
+            if (!smash.events.sleepFor(interval_ms))
+            {
+                break;
+            }
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double seconds = (now.tv_sec - last_time.tv_sec) + (now.tv_nsec - last_time.tv_nsec) / 1e9;
+            last_time = now;
+            for (size_t i = 0; i < targets.size(); ++i)
+            {
+                ProcMonTarget &target = targets[i];
+                if (!_readTarget(target, buf, sizeof(buf), &fields))
+                {
+                    // Exited since the last refresh
+                    if (target.fd != -1)
+                    {
+                        close(target.fd);
+                        target.fd = -1;
+                    }
+                    continue;
+                }
+                target.cpu = seconds > 0 ? 100.0 * ((fields.ticks - target.ticks) / static_cast<double>(hertz)) / seconds : 0;
+                target.ticks = fields.ticks;
+            }
+        }
+
+        rows.clear();
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            if (targets[i].fd != -1)
+            {
+                rows.push_back(&targets[i]);
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [by_rss](const ProcMonTarget *a, const ProcMonTarget *b)
+                  { return by_rss ? a->rss_pages > b->rss_pages : a->cpu > b->cpu; });
+
+        if (printed > 0)
+        {
+            cout << "\n";
+        }
+        cout << std::left << std::setw(8) << "PID" << std::right << std::setw(7) << "CPU%" << std::setw(10) << "MEM MB"
+             << "  S  COMMAND\n";
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            const ProcMonTarget &row = *rows[i];
+            cout << std::left << std::setw(8) << row.pid << std::right << std::fixed << std::setprecision(1)
+                 << std::setw(7) << row.cpu << std::setw(10) << (row.rss_pages * page_size) / (1024.0 * 1024.0)
+                 << "  " << row.state << "  " << row.label << "\n";
+        }
+        cout << std::flush;
+        if (sampling && rows.empty())
+        {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        if (targets[i].fd != -1)
+        {
+            close(targets[i].fd);
+        }
+    }
+    if (raised)
+    {
+        setrlimit(RLIMIT_NOFILE, &saved_limit);
+    }
+}
+
 void ChangeDirCommand::execute()
 {
     if (this->args_count == 1)
@@ -867,454 +2022,3084 @@ void ForegroundCommand::execute()
 
     if (job->stopped)
     {
-        if (kill(job->pid, SIGCONT) == -1)
+        if (job->sendSignal(SIGCONT) == -1)
         {
             perror("smash error: SIGCONT failed");
             return;
         }
-        job->stopped = false;
+        jobs->setStopped(job, false);
     }
 
+    // Ctrl-C erases the job while we wait, so job must not be used after
+    // waitChild. The copy keeps what the history needs.
     SmallShell &smash = SmallShell::getInstance();
-    smash.fg_pid = job->pid;
+    JobsList::JobEntry fg_job = *job;
+    pid_t pid = fg_job.pid;
+    smash.fg_pid = pid;
+
+    std::cout << fg_job.command << " " << pid << std::endl;
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    // a pipeline is done once all of its stages are, they share pid's group
+    while (true)
+    {
+        pid_t reaped = smash.events.waitChild(fg_job.pipeline ? -pid : pid, &status, WUNTRACED, &usage);
+        if (reaped == -1)
+        {
+            // nothing was reaped, status and usage say nothing about the job
+            perror("smash error: waitpid failed");
+            smash.fg_pid = -1;
+            return;
+        }
+        if (WIFSTOPPED(status))
+        {
+            job = jobs->getJobByPid(pid);
+            if (job)
+            {
+                jobs->setStopped(job, true);
+            }
+            break;
+        }
 
-    std::cout << job->command << " " << job->pid << std::endl;
-    int status;
-    if (waitpid(job->pid, &status, WUNTRACED) == -1)
+        smash.foreground_usage.add(usage);
+        fg_job.members.erase(std::remove(fg_job.members.begin(), fg_job.members.end(), reaped), fg_job.members.end());
+        if (reaped == fg_job.last_stage)
+        {
+            fg_job.status = status;
+        }
+        if (fg_job.members.empty())
+        {
+            smash.setWaitStatus(fg_job.status);
+            jobs->recordFinished(fg_job, fg_job.status, usage);
+            jobs->removeJobByPid(pid);
+            break;
+        }
+        fg_job.usage.add(usage);
+        jobs->childEnded(reaped, status, usage);
+    }
+
+    smash.fg_pid = -1;
+}
+
+void JobsCommand::execute()
+{
+    this->jobs->printJobsList(this->args_count > 1 && strcmp(this->args[1], "-l") == 0);
+}
+
+// Reads one word at src into word like _parseCommandLine does. word must
+// hold the rest of the line. start gets where the word began in the raw
+// line. Returns false at the end of the line.
+static bool _readWord(const char *&src, char *word, const char **start)
+{
+    while (_isWhitespace(*src))
+    {
+        src++;
+    }
+    if (!*src)
+    {
+        return false;
+    }
+    *start = src;
+    bool quoted;
+    _copyWord(src, word, &quoted);
+    return true;
+}
+
+// Single quotes that keep an item one word whatever it holds: 'it'"'"'s'
+static string _quoteWord(const string &word)
+{
+    string quoted = "'";
+    for (size_t i = 0; i < word.size(); ++i)
+    {
+        if (word[i] == '\'')
+        {
+            quoted += "'\"'\"'";
+        }
+        else
+        {
+            quoted += word[i];
+        }
+    }
+    return quoted + "'";
+}
+
+// Every {} in line replaced by the item, or the item added as the last word
+static string _fillTemplate(const string &line, const string &item)
+{
+    string quoted = _quoteWord(item);
+    string filled;
+    size_t from = 0;
+    size_t at;
+    while ((at = line.find("{}", from)) != string::npos)
+    {
+        filled.append(line, from, at - from);
+        filled += quoted;
+        from = at + 2;
+    }
+    if (from == 0)
+    {
+        return line + " " + quoted;
+    }
+    filled.append(line, from, string::npos);
+    return filled;
+}
+
+// One command of parallel. It is done once its stdout hit EOF (fd -1) and
+// it was reaped (pid -1).
+struct ParallelRun
+{
+    pid_t pid;
+    int fd;
+    string output;
+};
+
+void ParallelCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long limit = cpus > 1 ? cpus : 1;
+
+    // -j N, then the template words up to :::
+    const char *src = this->cmd_line;
+    const char *start;
+    vector<char> word_buf(strlen(src) + 1);
+    char *word = word_buf.data();
+    _readWord(src, word, &start);
+    string template_line;
+    const char *template_start = nullptr;
+    const char *template_end = nullptr;
+    int template_words = 0;
+    bool has_items = false;
+    while (_readWord(src, word, &start))
+    {
+        if (!template_start && strncmp(word, "-j", 2) == 0)
+        {
+            const char *count = word + 2;
+            char *end;
+            if (!*count && _readWord(src, word, &start))
+            {
+                count = word;
+            }
+            limit = strtol(count, &end, 10);
+            if (!*count || *end || limit < 1)
+            {
+                cerr << "smash error: parallel: invalid arguments" << endl;
+                return;
+            }
+            continue;
+        }
+        if (strcmp(word, ":::") == 0)
+        {
+            has_items = true;
+            break;
+        }
+        if (!template_start)
+        {
+            template_start = start;
+        }
+        template_end = src;
+        template_line = word;
+        template_words++;
+    }
+    if (template_words == 0)
+    {
+        cerr << "smash error: parallel: invalid arguments" << endl;
+        return;
+    }
+    if (template_words > 1)
+    {
+        // several words are the command as typed, one word is a quoted template
+        template_line.assign(template_start, template_end - template_start);
+    }
+
+    deque<string> items;
+    while (has_items && _readWord(src, word, &start))
+    {
+        items.push_back(word);
+    }
+    bool reading = !has_items;
+    string partial;
+
+    // Like xargs, the commands get /dev/null while stdin carries the items,
+    // otherwise one that reads stdin would eat the rest of them
+    int null_fd = -1;
+    if (reading && (null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        perror("smash error: open failed");
+        return;
+    }
+
+    // runs stays in input order, the front is the next one to print
+    deque<ParallelRun> runs;
+    long running = 0;
+    int failed = 0;
+    char buf[BUF_SIZE];
+    vector<struct pollfd> fds;
+    vector<ParallelRun *> polled;
+    while (true)
     {
-        perror("smash error: waitpid failed");
+        // A command may close its stdout and keep running, so never block on it.
+        // pollFds returns when SIGCHLD shows up to get here again.
+        for (size_t i = 0; i < runs.size(); ++i)
+        {
+            ParallelRun &run = runs[i];
+            if (run.fd != -1 || run.pid == -1)
+            {
+                continue;
+            }
+            int status;
+            struct rusage usage;
+            pid_t reaped = wait4(run.pid, &status, WNOHANG, &usage);
+            if (reaped == 0 || (reaped == -1 && errno == EINTR))
+            {
+                continue;
+            }
+            if (reaped == run.pid)
+            {
+                smash.foreground_usage.add(usage);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    failed++;
+                }
+            }
+            run.pid = -1;
+            running--;
+        }
+
+        while (running < limit && !items.empty())
+        {
+            string command = _fillTemplate(template_line, items.front());
+            items.pop_front();
+            ParallelRun run = {-1, -1, string()};
+            int pipe_fds[2];
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+            {
+                perror("smash error: pipe failed");
+                failed++;
+                runs.push_back(run);
+                continue;
+            }
+            ExternalCommand cmd(command.c_str(), command, false, command);
+            run.pid = cmd.spawn(pipe_fds[1], null_fd);
+            close(pipe_fds[1]);
+            if (run.pid == -1)
+            {
+                close(pipe_fds[0]);
+                failed++;
+            }
+            else
+            {
+                run.fd = pipe_fds[0];
+                running++;
+            }
+            runs.push_back(run);
+        }
+
+        bool printed = false;
+        while (!runs.empty() && runs.front().fd == -1 && runs.front().pid == -1)
+        {
+            cout << runs.front().output;
+            runs.pop_front();
+            printed = true;
+        }
+        if (printed)
+        {
+            cout.flush();
+        }
+        if (running == 0 && items.empty() && !reading)
+        {
+            break;
+        }
+
+        fds.clear();
+        polled.clear();
+        for (size_t i = 0; i < runs.size(); ++i)
+        {
+            if (runs[i].fd != -1)
+            {
+                struct pollfd pfd = {runs[i].fd, POLLIN, 0};
+                fds.push_back(pfd);
+                polled.push_back(&runs[i]);
+            }
+        }
+        // read items only a little ahead of the free slots
+        bool want_items = reading && items.size() < (size_t)limit;
+        if (want_items)
+        {
+            struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+            fds.push_back(pfd);
+        }
+        if (smash.events.pollFds(fds.data(), fds.size(), -1) == -1)
+        {
+            // Ctrl-C: the commands lead their own process groups, so take them down here
+            for (size_t i = 0; i < runs.size(); ++i)
+            {
+                if (runs[i].pid != -1)
+                {
+                    kill(runs[i].pid, SIGKILL);
+                    waitpid(runs[i].pid, nullptr, 0);
+                }
+                if (runs[i].fd != -1)
+                {
+                    close(runs[i].fd);
+                }
+            }
+            if (null_fd != -1)
+            {
+                close(null_fd);
+            }
+            smash.last_status = 130;
+            return;
+        }
+
+        for (size_t i = 0; i < polled.size(); ++i)
+        {
+            if (!fds[i].revents)
+            {
+                continue;
+            }
+            ParallelRun &run = *polled[i];
+            ssize_t bytes = read(run.fd, buf, sizeof(buf));
+            if (bytes > 0 || (bytes == -1 && errno == EINTR))
+            {
+                run.output.append(buf, bytes > 0 ? bytes : 0);
+                continue;
+            }
+            // EOF on its stdout, it is reaped at the top of the loop once it exits
+            close(run.fd);
+            run.fd = -1;
+        }
+
+        if (want_items && fds.back().revents)
+        {
+            ssize_t bytes = read(STDIN_FILENO, buf, sizeof(buf));
+            if (bytes > 0)
+            {
+                partial.append(buf, bytes);
+                size_t line_end;
+                while ((line_end = partial.find('\n')) != string::npos)
+                {
+                    items.push_back(partial.substr(0, line_end));
+                    partial.erase(0, line_end + 1);
+                }
+            }
+            else if (bytes == 0 || errno != EINTR)
+            {
+                reading = false;
+                if (!partial.empty())
+                {
+                    items.push_back(partial);
+                }
+            }
+        }
+    }
+
+    // like GNU parallel, the number of commands that failed
+    if (null_fd != -1)
+    {
+        close(null_fd);
+    }
+    smash.last_status = std::min(failed, 101);
+}
+
+// The queue runs line later from the main loop, so it has to become a
+// background job there. Split the way CreateCommand will: a builtin would run
+// inside smash and a redirection in the foreground, pipelines are fine.
+static bool _canQueue(const string &line)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    string cmd_s = line;
+    string first_word = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+    const string *alias = smash.getAliases().find(first_word.data(), first_word.size());
+    if (alias)
+    {
+        cmd_s = _trim(*alias + cmd_s.substr(first_word.size()));
+        first_word = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+    }
+
+    const BuiltinEntry *builtin = findBuiltin(first_word.c_str());
+    vector<string> stages;
+    vector<bool> stderr_pipes;
+    if (!(builtin && builtin->whole_line) && _splitPipeline(cmd_s, stages, stderr_pipes))
+    {
+        return true;
+    }
+    if (!(builtin && builtin->whole_line) && cmd_s.find('>') != string::npos)
+    {
+        cerr << "smash error: jobq: redirections cannot be queued" << endl;
+        return false;
+    }
+    if (builtin && !builtin->starts_job)
+    {
+        cerr << "smash error: jobq: " << first_word << " is a builtin and cannot be queued" << endl;
+        return false;
+    }
+    return true;
+}
+
+void JobQueueCommand::execute()
+{
+    int limit = 0;
+    int priority = 0;
+    bool wait = false;
+    int word = 1;
+    for (; word < this->args_count && this->args[word][0] == '-'; ++word)
+    {
+        if (strcmp(this->args[word], "-w") == 0)
+        {
+            wait = true;
+            continue;
+        }
+        bool is_limit = strcmp(this->args[word], "-j") == 0;
+        if ((!is_limit && strcmp(this->args[word], "-p") != 0) || word + 1 >= this->args_count)
+        {
+            cerr << "smash error: jobq: invalid arguments" << endl;
+            return;
+        }
+        char *end;
+        long value = strtol(this->args[++word], &end, 10);
+        if (*end || (is_limit && value < 1))
+        {
+            cerr << "smash error: jobq: invalid arguments" << endl;
+            return;
+        }
+        if (is_limit)
+        {
+            limit = value;
+        }
+        else
+        {
+            priority = value;
+        }
+    }
+
+    // The command is the rest of the raw line, so quotes and & survive
+    const char *command = this->cmd_line;
+    for (int skipped = 0; skipped < word; ++skipped)
+    {
+        while (_isWhitespace(*command))
+        {
+            command++;
+        }
+        while (*command && !_isWhitespace(*command))
+        {
+            command++;
+        }
+    }
+    string line = _trim(command);
+
+    if (limit)
+    {
+        jobs->setQueueLimit(limit);
+    }
+    if (!line.empty())
+    {
+        if (line[line.size() - 1] != '&')
+        {
+            line += " &";
+        }
+        if (!_canQueue(line))
+        {
+            return;
+        }
+        jobs->enqueue(line, priority);
+    }
+    else if (!limit && !wait)
+    {
+        jobs->printQueue();
+    }
+    if (wait)
+    {
+        jobs->waitQueue(true);
+    }
+}
+
+void TimeCommand::execute()
+{
+    // Everything after the leading "time" is the command to measure
+    const char *command = this->cmd_line;
+    while (_isWhitespace(*command))
+    {
+        command++;
+    }
+    command += strlen("time");
+    while (_isWhitespace(*command))
+    {
+        command++;
+    }
+
+    // Foreground children add to foreground_usage as they are reaped,
+    // builtins run in smash itself and show up in RUSAGE_SELF
+    SmallShell &smash = SmallShell::getInstance();
+    JobUsage outer = smash.foreground_usage;
+    smash.foreground_usage = JobUsage();
+    struct rusage self_before;
+    struct rusage self_after;
+    struct timespec start;
+    struct timespec end;
+    getrusage(RUSAGE_SELF, &self_before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (*command)
+    {
+        smash.executeCommand(command);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self_after);
+    JobUsage used = smash.foreground_usage;
+    used.real_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    used.user_seconds += (self_after.ru_utime.tv_sec - self_before.ru_utime.tv_sec) +
+                         (self_after.ru_utime.tv_usec - self_before.ru_utime.tv_usec) / 1e6;
+    used.sys_seconds += (self_after.ru_stime.tv_sec - self_before.ru_stime.tv_sec) +
+                        (self_after.ru_stime.tv_usec - self_before.ru_stime.tv_usec) / 1e6;
+    used.voluntary_switches += self_after.ru_nvcsw - self_before.ru_nvcsw;
+    used.involuntary_switches += self_after.ru_nivcsw - self_before.ru_nivcsw;
+    cerr << used << endl;
+
+    // time inside time: the outer one still sees the inner children
+    outer.add(used);
+    smash.foreground_usage = outer;
+}
+
+// "512K", "1G" (powers of 1024) or "max", as a cgroup file value
+static bool _parseLimitSize(const char *text, string *value)
+{
+    if (strcmp(text, "max") == 0)
+    {
+        *value = text;
+        return true;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long bytes = strtoull(text, &end, 10);
+    if (end == text || errno != 0 || *text == '-')
+    {
+        return false;
+    }
+    if (*end)
+    {
+        const char *units = "KMGT";
+        const char *unit = strchr(units, toupper((unsigned char)*end));
+        if (!unit || end[1] != '\0')
+        {
+            return false;
+        }
+        bytes <<= 10 * (unit - units + 1);
+    }
+    *value = std::to_string(bytes);
+    return true;
+}
+
+// One limit= word as the controller it needs and the file line to write.
+// cpu=50% is a cpu.max quota over a 100ms period, io=MAJ:MIN:BPS caps both
+// read and write bandwidth of that device.
+static bool _parseLimit(const string &key, const string &value, const char **controller, const char **file,
+                        string *line)
+{
+    if (key == "cpu")
+    {
+        *controller = "cpu";
+        *file = "cpu.max";
+        if (value == "max")
+        {
+            *line = "max 100000";
+            return true;
+        }
+        char *end;
+        double percent = strtod(value.c_str(), &end);
+        // the kernel wants a quota of at least 1ms
+        if (end == value.c_str() || (*end && strcmp(end, "%") != 0) || percent < 1)
+        {
+            return false;
+        }
+        *line = std::to_string((long)(percent * 1000)) + " 100000";
+        return true;
+    }
+    if (key == "mem")
+    {
+        *controller = "memory";
+        *file = "memory.max";
+        return _parseLimitSize(value.c_str(), line);
+    }
+    if (key == "io")
+    {
+        *controller = "io";
+        *file = "io.max";
+        unsigned major;
+        unsigned minor;
+        int used = 0;
+        string bps;
+        if (sscanf(value.c_str(), "%u:%u:%n", &major, &minor, &used) != 2 || used == 0 ||
+            !_parseLimitSize(value.c_str() + used, &bps))
+        {
+            return false;
+        }
+        *line = std::to_string(major) + ":" + std::to_string(minor) + " rbps=" + bps + " wbps=" + bps;
+        return true;
+    }
+    return false;
+}
+
+static bool _writeCgroupFile(const string &path, const string &value)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    bool written = fd != -1 && write(fd, value.data(), value.size()) == (ssize_t)value.size();
+    int saved_errno = errno;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    errno = saved_errno; // callers tell the failures apart
+    return written;
+}
+
+void LimitCommand::execute()
+{
+    const char *root = getenv("SMASH_CGROUP_ROOT");
+    if (!root || !*root)
+    {
+        cerr << "smash error: limit: SMASH_CGROUP_ROOT is not set" << endl;
+        return;
+    }
+
+    // key=value words up to the first one that is not a limit, that is the command
+    vector<const char *> controllers;
+    vector<pair<const char *, string>> files;
+    const char *command = this->cmd_line;
+    while (_isWhitespace(*command))
+    {
+        command++;
+    }
+    command += strlen("limit");
+    while (true)
+    {
+        while (_isWhitespace(*command))
+        {
+            command++;
+        }
+        const char *end = command;
+        while (*end && !_isWhitespace(*end))
+        {
+            end++;
+        }
+        string word(command, end - command);
+        size_t equals = word.find('=');
+        string key = word.substr(0, equals);
+        if (equals == string::npos || (key != "cpu" && key != "mem" && key != "io"))
+        {
+            break;
+        }
+        const char *controller;
+        const char *file;
+        string line;
+        if (!_parseLimit(key, word.substr(equals + 1), &controller, &file, &line))
+        {
+            cerr << "smash error: limit: invalid limit " << word << endl;
+            return;
+        }
+        controllers.push_back(controller);
+        files.push_back(make_pair(file, line));
+        command = end;
+    }
+
+    SmallShell &smash = SmallShell::getInstance();
+    Command *cmd = *command ? smash.CreateCommand(command) : nullptr;
+    ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+    if (!external)
+    {
+        cerr << "smash error: limit: only external commands can be limited" << endl;
+        delete cmd;
+        return;
+    }
+
+    // Controllers have to be enabled on the parent before the child gets the files
+    string base(root);
+    for (size_t i = 0; i < controllers.size(); ++i)
+    {
+        if (!_writeCgroupFile(base + "/cgroup.subtree_control", string("+") + controllers[i]))
+        {
+            if (errno == EBUSY)
+            {
+                // cgroup v2 only hands controllers down from a cgroup without processes of its own
+                cerr << "smash error: limit: " << base << " has processes of its own, move them to a child "
+                     << "cgroup so the " << controllers[i] << " controller can be enabled below it" << endl;
+            }
+            else
+            {
+                cerr << "smash error: limit: the " << controllers[i] << " controller is not available in "
+                     << base << endl;
+            }
+            delete cmd;
+            return;
+        }
+    }
+
+    static unsigned long serial = 0;
+    string cgroup = base + "/smash-" + std::to_string(getpid()) + "-" + std::to_string(++serial);
+    if (mkdir(cgroup.c_str(), 0755) == -1)
+    {
+        perror("smash error: limit: mkdir failed");
+        delete cmd;
+        return;
+    }
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!_writeCgroupFile(cgroup + "/" + files[i].first, files[i].second))
+        {
+            cerr << "smash error: limit: writing " << files[i].first << " failed" << endl;
+            rmdir(cgroup.c_str());
+            delete cmd;
+            return;
+        }
+    }
+
+    external->cgroup_fd = open(cgroup.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (external->cgroup_fd == -1)
+    {
+        perror("smash error: limit: open failed");
+        rmdir(cgroup.c_str());
+        delete cmd;
+        return;
+    }
+    external->cgroup = cgroup;
+    external->execute();
+    close(external->cgroup_fd);
+    delete cmd;
+
+    // Busy while a background job runs in it, the job removes it once reaped
+    rmdir(cgroup.c_str());
+}
+
+void JobUsage::add(const struct rusage &usage)
+{
+    this->user_seconds += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    this->sys_seconds += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    this->max_rss_kb = std::max(this->max_rss_kb, (long)usage.ru_maxrss);
+    this->voluntary_switches += usage.ru_nvcsw;
+    this->involuntary_switches += usage.ru_nivcsw;
+}
+
+void JobUsage::add(const JobUsage &other)
+{
+    this->real_seconds += other.real_seconds;
+    this->user_seconds += other.user_seconds;
+    this->sys_seconds += other.sys_seconds;
+    this->max_rss_kb = std::max(this->max_rss_kb, other.max_rss_kb);
+    this->voluntary_switches += other.voluntary_switches;
+    this->involuntary_switches += other.involuntary_switches;
+}
+
+std::ostream &operator<<(std::ostream &out, const JobUsage &usage)
+{
+    // Formatted on the side so cout's own flags are left alone
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3) << "real " << usage.real_seconds << "s  user " << usage.user_seconds
+         << "s  sys " << usage.sys_seconds << "s  maxrss " << usage.max_rss_kb << " KB  ctxsw "
+         << usage.voluntary_switches << "/" << usage.involuntary_switches;
+    return out << line.str();
+}
+
+// What a job still running has used so far, from /proc
+static JobUsage _liveUsage(const JobsList::JobEntry &job)
+{
+    JobUsage usage;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usage.real_seconds = (now.tv_sec - job.started.tv_sec) + (now.tv_nsec - job.started.tv_nsec) / 1e9;
+
+    char path[64];
+    char buf[BUF_SIZE];
+    ProcStat fields;
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)job.pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1 && _preadProc(fd, buf, sizeof(buf)) && _scanProcStat(buf, &fields))
+    {
+        double hertz = sysconf(_SC_CLK_TCK);
+        usage.user_seconds = fields.utime / hertz;
+        usage.sys_seconds = fields.stime / hertz;
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)job.pid);
+    LineReader status(path);
+    const char *line;
+    size_t len;
+    while (status.next(line, len))
+    {
+        if (strncmp(line, "VmHWM:", 6) == 0)
+        {
+            usage.max_rss_kb = strtol(line + 6, nullptr, 10);
+        }
+        else if (strncmp(line, "voluntary_ctxt_switches:", 24) == 0)
+        {
+            usage.voluntary_switches = strtol(line + 24, nullptr, 10);
+        }
+        else if (strncmp(line, "nonvoluntary_ctxt_switches:", 27) == 0)
+        {
+            usage.involuntary_switches = strtol(line + 27, nullptr, 10);
+        }
+    }
+    return usage;
+}
+
+// Pressure stall info of a limit cgroup, the avg10 of each "some" line:
+// "psi cpu 0.00% mem 0.00% io 0.00%"
+static string _cgroupPressure(const string &cgroup)
+{
+    static const char *const files[] = {"cpu.pressure", "memory.pressure", "io.pressure"};
+    static const char *const names[] = {"cpu", "mem", "io"};
+    string line = "psi";
+    for (int i = 0; i < 3; ++i)
+    {
+        char buf[256];
+        int fd = open((cgroup + "/" + files[i]).c_str(), O_RDONLY | O_CLOEXEC);
+        const char *avg = nullptr;
+        if (fd != -1 && _preadProc(fd, buf, sizeof(buf)))
+        {
+            avg = strstr(buf, "some avg10=");
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        line += string(" ") + names[i] + " ";
+        if (avg)
+        {
+            avg += strlen("some avg10=");
+            line.append(avg, strcspn(avg, " \n"));
+            line += "%";
+        }
+        else
+        {
+            line += "-";
+        }
+    }
+    return line;
+}
+
+void JobsList::recordFinished(const JobEntry &job, int status, const struct rusage &usage)
+{
+    FinishedJob entry;
+    entry.job_id = job.job_id;
+    entry.command = job.command;
+    entry.status = status;
+    entry.usage = job.usage;
+    entry.usage.add(usage);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    entry.usage.real_seconds = (now.tv_sec - job.started.tv_sec) + (now.tv_nsec - job.started.tv_nsec) / 1e9;
+
+    finished.push_back(entry);
+    if (finished.size() > JOBS_HISTORY_SIZE)
+    {
+        finished.pop_front();
+    }
+}
+
+JobsList::JobsList() : head(-1), tail(-1), stopped_head(-1), stopped_tail(-1), count(0), queue_order(0), queue_limit(1),
+                       queue_running(0), jobs_added(0)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1)
+    {
+        queue_limit = cpus;
+    }
+}
+
+int JobsList::slotOf(int jobId) const
+{
+    if (jobId <= 0 || (size_t)jobId >= id_index.size())
+    {
+        return -1;
+    }
+    return id_index[jobId];
+}
+
+void JobsList::addJob(Command *cmd, pid_t pid, bool stopped, const string &cgroup)
+{
+    addJob(cmd, std::vector<pid_t>(1, pid), stopped, cgroup);
+}
+
+void JobsList::addJob(Command *cmd, const std::vector<pid_t> &pids, bool stopped, const string &cgroup)
+{
+    removeFinishedJobs();
+
+    // ids keep growing from the highest live one, so appending keeps the list sorted
+    int job_id = (tail == -1) ? 1 : slots[tail].job_id + 1;
+    pid_t pid = pids.front();
+    JobEntry entry(job_id, pid, cmd->cmd_line, false);
+    entry.pipeline = pids.size() > 1;
+    entry.members = pids;
+    entry.last_stage = pids.back();
+    clock_gettime(CLOCK_MONOTONIC, &entry.started);
+    for (size_t i = 0; i < unclaimed.size(); ++i)
+    {
+        auto member = std::find(entry.members.begin(), entry.members.end(), unclaimed[i].pid);
+        if (member == entry.members.end())
+        {
+            continue;
+        }
+        entry.members.erase(member);
+        if (unclaimed[i].pid == entry.last_stage)
+        {
+            entry.status = unclaimed[i].status;
+        }
+        if (entry.members.empty())
+        {
+            // already gone, a job for it would never be reaped
+            recordFinished(entry, entry.status, unclaimed[i].usage);
+            unclaimed.clear();
+            if (!cgroup.empty())
+            {
+                rmdir(cgroup.c_str());
+            }
+            return;
+        }
+        entry.usage.add(unclaimed[i].usage);
+    }
+    unclaimed.clear();
+    if (entry.members.front() == pid)
+    {
+        entry.pidfd = SmallShell::getInstance().events.watchChild(pid);
+    }
+    entry.cgroup = cgroup;
+    jobs_added++;
+
+    int slot;
+    if (!free_slots.empty())
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot] = entry;
+    }
+    else
+    {
+        slot = slots.size();
+        slots.push_back(entry);
+    }
+
+    if ((size_t)job_id >= id_index.size())
+    {
+        id_index.resize(job_id + 1, -1);
+    }
+    id_index[job_id] = slot;
+    pid_index[pid] = slot;
+    for (size_t i = 0; i < slots[slot].members.size(); ++i)
+    {
+        pid_index[slots[slot].members[i]] = slot;
+    }
+
+    slots[slot].prev = tail;
+    if (tail != -1)
+    {
+        slots[tail].next = slot;
+    }
+    else
+    {
+        head = slot;
+    }
+    tail = slot;
+    count++;
+
+    if (stopped)
+    {
+        setStopped(&slots[slot], true);
+    }
+}
+
+void JobsList::printJobsList(bool verbose)
+{
+    removeFinishedJobs(); // Ensure finished jobs are not printed
+    for (int slot = head; slot != -1; slot = slots[slot].next)
+    {
+        const JobEntry &job = slots[slot];
+        std::cout << "[" << job.job_id << "] " << job.command;
+        if (!job.cgroup.empty())
+        {
+            std::cout << "  " << _cgroupPressure(job.cgroup);
+        }
+        if (verbose)
+        {
+            std::cout << "  " << (job.stopped ? "stopped" : "running") << "  " << _liveUsage(job);
+        }
+        std::cout << std::endl;
+    }
+    if (!verbose || finished.empty())
+    {
+        return;
+    }
+    std::cout << "finished:" << std::endl;
+    for (size_t i = 0; i < finished.size(); ++i)
+    {
+        const FinishedJob &job = finished[i];
+        std::cout << "[" << job.job_id << "] " << job.command << "  ";
+        if (WIFSIGNALED(job.status))
+        {
+            std::cout << "signal " << WTERMSIG(job.status);
+        }
+        else
+        {
+            std::cout << "exit " << WEXITSTATUS(job.status);
+        }
+        std::cout << "  " << job.usage << std::endl;
+    }
+}
+
+void JobsList::killAllJobs()
+{
+    removeFinishedJobs();
+    cout << "smash: sending SIGKILL signal to " << count << " jobs:" << endl;
+    for (int slot = head; slot != -1; slot = slots[slot].next)
+    {
+        const JobEntry &job = slots[slot];
+        cout << job.pid << ": " << job.command << endl;
+        int _res = job.sendSignal(SIGKILL);
+
+        if (_res == -1)
+        {
+            perror("smash error: kill failed");
+            return;
+        }
+    }
+    // A cgroup can only be removed once nothing runs in it, so the limited
+    // jobs are waited for before eraseSlot removes their directories
+    for (int slot = head; slot != -1; slot = slots[slot].next)
+    {
+        const JobEntry &job = slots[slot];
+        for (size_t i = 0; !job.cgroup.empty() && i < job.members.size(); ++i)
+        {
+            while (waitpid(job.members[i], nullptr, 0) == -1 && errno == EINTR)
+            {
+            }
+        }
+    }
+    while (head != -1)
+    {
+        eraseSlot(head);
+    }
+}
+
+void JobsList::releaseCgroups()
+{
+    // jobs that ended take their directories with them here
+    removeFinishedJobs();
+    for (int slot = head; slot != -1; slot = slots[slot].next)
+    {
+        JobEntry &job = slots[slot];
+        if (!job.cgroup.empty() && rmdir(job.cgroup.c_str()) == -1)
+        {
+            cerr << "smash error: limit: job [" << job.job_id << "] still runs in " << job.cgroup
+                 << ", remove it once the job ends" << endl;
+        }
+        job.cgroup.clear();
+    }
+}
+
+void JobsList::setStopped(JobEntry *job, bool stopped)
+{
+    if (job->stopped == stopped)
+    {
+        return;
+    }
+    int slot = job - slots.data();
+    job->stopped = stopped;
+    if (!stopped)
+    {
+        unlinkStopped(slot);
+        return;
+    }
+
+    // insert in job-id order; jobs usually stop in the order they were started,
+    // so this walk stops right at the tail
+    int after = stopped_tail;
+    while (after != -1 && slots[after].job_id > job->job_id)
+    {
+        after = slots[after].prev_stopped;
+    }
+    job->prev_stopped = after;
+    job->next_stopped = (after == -1) ? stopped_head : slots[after].next_stopped;
+    if (job->prev_stopped != -1)
+    {
+        slots[job->prev_stopped].next_stopped = slot;
+    }
+    else
+    {
+        stopped_head = slot;
+    }
+    if (job->next_stopped != -1)
+    {
+        slots[job->next_stopped].prev_stopped = slot;
+    }
+    else
+    {
+        stopped_tail = slot;
+    }
+}
+
+void JobsList::unlinkStopped(int slot)
+{
+    JobEntry &job = slots[slot];
+    if (job.prev_stopped != -1)
+    {
+        slots[job.prev_stopped].next_stopped = job.next_stopped;
+    }
+    else if (stopped_head == slot)
+    {
+        stopped_head = job.next_stopped;
+    }
+    if (job.next_stopped != -1)
+    {
+        slots[job.next_stopped].prev_stopped = job.prev_stopped;
+    }
+    else if (stopped_tail == slot)
+    {
+        stopped_tail = job.prev_stopped;
+    }
+    job.prev_stopped = job.next_stopped = -1;
+}
+
+void JobsList::eraseSlot(int slot)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    JobEntry &job = slots[slot];
+    if (job.pid == smash.fg_pid)
+    {
+        smash.fg_pid = -1;
+    }
+    if (job.pidfd != -1)
+    {
+        // closing it also drops it from the epoll set
+        close(job.pidfd);
+        job.pidfd = -1;
+    }
+    if (job.stopped)
+    {
+        unlinkStopped(slot);
+    }
+    if (!job.cgroup.empty())
+    {
+        // fails while something still runs in it, e.g. a child the job left behind
+        rmdir(job.cgroup.c_str());
+        job.cgroup.clear();
+    }
+    if (job.queued)
+    {
+        // the main loop calls startQueued once the reaping is done
+        queue_running--;
+        job.queued = false;
+    }
+
+    if (job.prev != -1)
+    {
+        slots[job.prev].next = job.next;
+    }
+    else
+    {
+        head = job.next;
+    }
+    if (job.next != -1)
+    {
+        slots[job.next].prev = job.prev;
+    }
+    else
+    {
+        tail = job.prev;
+    }
+
+    pid_index.erase(job.pid);
+    for (size_t i = 0; i < job.members.size(); ++i)
+    {
+        pid_index.erase(job.members[i]);
+    }
+    job.members.clear();
+    id_index[job.job_id] = -1;
+    job.command.clear();
+    free_slots.push_back(slot);
+    count--;
+}
+
+void JobsList::reapJob(pid_t pid)
+{
+    auto index = pid_index.find(pid);
+    if (index == pid_index.end())
+    {
+        return;
+    }
+    const std::vector<pid_t> &members = slots[index->second].members;
+    if (std::find(members.begin(), members.end(), pid) == members.end())
+    {
+        // a pipeline leader removeFinishedJobs got to first
+        return;
+    }
+    // -1 means someone else already reaped it
+    int status;
+    struct rusage usage;
+    pid_t res = wait4(pid, &status, WNOHANG, &usage);
+    if (res == pid)
+    {
+        memberEnded(index->second, pid, status, usage);
+    }
+    else if (res != 0)
+    {
+        eraseSlot(index->second);
+    }
+}
+
+void JobsList::memberEnded(int slot, pid_t pid, int status, const struct rusage &usage)
+{
+    JobEntry &job = slots[slot];
+    job.members.erase(std::remove(job.members.begin(), job.members.end(), pid), job.members.end());
+    if (pid == job.last_stage)
+    {
+        job.status = status;
+    }
+    if (job.members.empty())
+    {
+        recordFinished(job, job.status, usage);
+        eraseSlot(slot);
+        return;
+    }
+
+    // other stages still run
+    job.usage.add(usage);
+    if (pid != job.pid)
+    {
+        // its pid may be reused now, the leader's not while the group lives
+        pid_index.erase(pid);
+    }
+    else if (job.pidfd != -1)
+    {
+        // stays readable from now on
+        close(job.pidfd);
+        job.pidfd = -1;
+    }
+}
+
+void JobsList::childEnded(pid_t pid, int status, const struct rusage &usage)
+{
+    auto index = pid_index.find(pid);
+    if (index == pid_index.end())
+    {
+        return;
+    }
+    const std::vector<pid_t> &members = slots[index->second].members;
+    if (std::find(members.begin(), members.end(), pid) != members.end())
+    {
+        memberEnded(index->second, pid, status, usage);
+    }
+}
+
+void JobsList::removeFinishedJobs()
+{
+    // pick up pending signals and pidfd events first
+    SmallShell::getInstance().events.dispatch(0);
+
+    // Nothing exited or stopped since the last call, so there is nothing to reap.
+    // Otherwise only the children that changed state are visited, not every job.
+    if (!children_changed)
+    {
+        return;
+    }
+    children_changed = 0;
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+    {
+        auto index = pid_index.find(pid);
+        if (index == pid_index.end())
+        {
+            // not a job (e.g. a stage of a background pipeline), or not yet:
+            // a child that exits at once can be reaped here from inside its own addJob
+            if (WIFEXITED(status) || WIFSIGNALED(status))
+            {
+                UnclaimedChild child = {pid, status, usage};
+                unclaimed.push_back(child);
+            }
+            continue;
+        }
+
+        if (WIFSTOPPED(status))
+        {
+            setStopped(&slots[index->second], true);
+        }
+        else if (WIFCONTINUED(status))
+        {
+            setStopped(&slots[index->second], false);
+        }
+        else
+        {
+            memberEnded(index->second, pid, status, usage);
+        }
+    }
+}
+
+JobsList::JobEntry *JobsList::getJobById(int jobId)
+{
+    removeFinishedJobs();
+    int slot = slotOf(jobId);
+    return slot == -1 ? nullptr : &slots[slot];
+}
+
+JobsList::JobEntry *JobsList::getJobByPid(pid_t pid)
+{
+    removeFinishedJobs();
+    auto index = pid_index.find(pid);
+    return index == pid_index.end() ? nullptr : &slots[index->second];
+}
+
+void JobsList::removeJobById(int jobId)
+{
+    int slot = slotOf(jobId);
+    if (slot != -1)
+    {
+        eraseSlot(slot);
+    }
+}
+
+void JobsList::removeJobByPid(pid_t pid)
+{
+    auto index = pid_index.find(pid);
+    if (index != pid_index.end())
+    {
+        eraseSlot(index->second);
+    }
+}
+
+JobsList::JobEntry *JobsList::getLastJob(int *lastJobId)
+{
+    removeFinishedJobs();
+    if (tail == -1)
+    {
+        return nullptr;
+    }
+    if (lastJobId)
+    {
+        *lastJobId = slots[tail].job_id;
+    }
+    return &slots[tail];
+}
+
+JobsList::JobEntry *JobsList::firstJob()
+{
+    return head == -1 ? nullptr : &slots[head];
+}
+
+JobsList::JobEntry *JobsList::nextJob(const JobEntry *job)
+{
+    return job->next == -1 ? nullptr : &slots[job->next];
+}
+
+// std heaps keep the largest on top: the highest priority, then the oldest
+static bool _startsLater(const JobsList::QueuedCommand &a, const JobsList::QueuedCommand &b)
+{
+    return a.priority != b.priority ? a.priority < b.priority : a.order > b.order;
+}
+
+void JobsList::enqueue(const string &cmd_line, int priority)
+{
+    QueuedCommand entry = {priority, queue_order++, cmd_line};
+    queue.push_back(entry);
+    std::push_heap(queue.begin(), queue.end(), _startsLater);
+    startQueued();
+}
+
+void JobsList::setQueueLimit(int limit)
+{
+    queue_limit = limit;
+    startQueued();
+}
+
+void JobsList::startQueued()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    while (!queue.empty() && queue_running < queue_limit)
+    {
+        std::pop_heap(queue.begin(), queue.end(), _startsLater);
+        string cmd_line = queue.back().cmd_line;
+        queue.pop_back();
+
+        // jobq only queues external commands, one that fails to start never becomes a job
+        Command *cmd = smash.CreateCommand(cmd_line.c_str());
+        unsigned long added = jobs_added;
+        if (cmd)
+        {
+            cmd->execute();
+            delete cmd;
+        }
+        if (jobs_added != added)
+        {
+            // addJob appends, and nothing is reaped before it returns
+            slots[tail].queued = true;
+            queue_running++;
+        }
+    }
+}
+
+bool JobsList::waitQueue(bool until_done)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    removeFinishedJobs();
+    startQueued();
+    while (!queue.empty() || (until_done && queue_running > 0))
+    {
+        if (!smash.events.waitChildEvent())
+        {
+            return false;
+        }
+        removeFinishedJobs();
+        startQueued();
+    }
+    return true;
+}
+
+void JobsList::printQueue()
+{
+    removeFinishedJobs();
+    cout << "limit " << queue_limit << ", " << queue_running << " running, " << queue.size() << " queued" << endl;
+    std::vector<QueuedCommand> order(queue);
+    std::sort(order.begin(), order.end(),
+              [](const QueuedCommand &a, const QueuedCommand &b) { return _startsLater(b, a); });
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        cout << "[" << order[i].priority << "] " << order[i].cmd_line << endl;
+    }
+}
+
+JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId)
+{
+    removeFinishedJobs();
+    if (stopped_tail == -1)
+    {
+        return nullptr;
+    }
+    if (jobId)
+    {
+        *jobId = slots[stopped_tail].job_id;
+    }
+    return &slots[stopped_tail];
+}
+
+AliasStore &SmallShell::getAliases()
+{
+    return this->aliases;
+}
+
+bool SmallShell::isReservedCommand(const string &command) const
+{
+    return findBuiltin(command.c_str()) != nullptr;
+}
+
+void CommandHash::checkPathChanged()
+{
+    const char *path = getenv("PATH");
+    string current;
+    if (path)
+    {
+        current = path;
+    }
+    else
+    {
+        // unset searches the default path like execvp, not the current directory
+        char buf[BUF_SIZE];
+        size_t length = confstr(_CS_PATH, buf, sizeof(buf));
+        current = (length > 0 && length <= sizeof(buf)) ? buf : "/bin:/usr/bin";
+    }
+    if (current != this->path_value)
+    {
+        this->table.clear();
+        this->path_value = current;
+    }
+}
+
+CommandHash::HashEntry *CommandHash::find(const char *name)
+{
+    checkPathChanged();
+
+    auto it = this->table.find(name);
+    if (it != this->table.end())
+    {
+        // the file may have been removed since we cached it
+        if (access(it->second.path.c_str(), X_OK) == 0)
+        {
+            return &it->second;
+        }
+        this->table.erase(it);
+    }
+
+    // Walk PATH once; an empty entry means the current directory
+    size_t start = 0;
+    while (start <= this->path_value.size())
+    {
+        size_t end = this->path_value.find(':', start);
+        if (end == string::npos)
+        {
+            end = this->path_value.size();
+        }
+        string dir = this->path_value.substr(start, end - start);
+        string candidate = (dir.empty() ? "." : dir) + "/" + name;
+
+        struct stat stat_buf;
+        if (stat(candidate.c_str(), &stat_buf) == 0 && S_ISREG(stat_buf.st_mode) && access(candidate.c_str(), X_OK) == 0)
+        {
+            if (dir.empty() || dir[0] != '/')
+            {
+                // relative to the current directory, which cd can change before the next launch
+                this->uncached = HashEntry(candidate);
+                return &this->uncached;
+            }
+            return &this->table.emplace(name, HashEntry(candidate)).first->second;
+        }
+        start = end + 1;
+    }
+    return nullptr;
+}
+
+const char *CommandHash::lookup(const char *name)
+{
+    if (strchr(name, '/'))
+    {
+        return name;
+    }
+    HashEntry *entry = find(name);
+    if (!entry)
+    {
+        return nullptr;
+    }
+    entry->hits++;
+    return entry->path.c_str();
+}
+
+bool CommandHash::add(const char *name)
+{
+    if (strchr(name, '/'))
+    {
+        return true;
+    }
+    return find(name) != nullptr;
+}
+
+void CommandHash::clear()
+{
+    this->table.clear();
+}
+
+void CommandHash::print()
+{
+    checkPathChanged();
+    if (this->table.empty())
+    {
+        std::cout << "smash: hash table empty" << std::endl;
+        return;
+    }
+    std::cout << "hits\tcommand" << std::endl;
+    for (const auto &pair : this->table)
+    {
+        std::cout << std::setw(4) << pair.second.hits << "\t" << pair.second.path << std::endl;
+    }
+}
+
+// pipesize command (built in command)
+void PipeSizeCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    if (this->args_count == 1)
+    {
+        if (smash.pipe_size > 0)
+        {
+            std::cout << smash.pipe_size << std::endl;
+        }
+        else
+        {
+            std::cout << "default" << std::endl;
+        }
+        return;
+    }
+
+    string size(this->args[1]);
+    if (this->args_count > 2 || size.empty() || !std::all_of(size.begin(), size.end(), ::isdigit) || size.size() > 9)
+    {
+        std::cerr << "smash error: pipesize: invalid arguments" << std::endl;
+        return;
+    }
+    // 0 goes back to the kernel default
+    smash.pipe_size = std::stoi(size);
+}
+
+// hash command (built in command)
+void HashCommand::execute()
+{
+    CommandHash &hash = SmallShell::getInstance().command_hash;
+
+    if (this->args_count == 1)
+    {
+        hash.print();
+        return;
+    }
+
+    int first = 1;
+    if (strcmp(this->args[1], "-r") == 0)
+    {
+        hash.clear();
+        first = 2;
+    }
+
+    for (int i = first; i < this->args_count; ++i)
+    {
+        if (!hash.add(this->args[i]))
+        {
+            cerr << "smash error: hash: " << this->args[i] << ": not found" << endl;
+        }
+    }
+}
+
+PipeCommand::PipeCommand(const char *cmd_line, const vector<string> &stages, const vector<bool> &stderr_pipes, bool is_background_command)
+    : Command(cmd_line), stages(stages), stderr_pipes(stderr_pipes), is_background_command(is_background_command) {}
+
+#define PIPE_CHUNK_SIZE (64 * 1024)
+
+// Streams a builtin's output into its pipe while the builtin runs, so the
+// next stage sees it at once and a full pipe holds the builtin back.
+// A full chunk is handed over with vmsplice from its own mapping: the pipe
+// keeps the pages after munmap, and the next chunk gets fresh ones instead of
+// overwriting data still queued. Flushes (endl) and short chunks use write.
+class PipeStreamBuf : public std::streambuf
+{
+public:
+    explicit PipeStreamBuf(int fd) : fd(fd), chunk(nullptr)
+    {
+        struct stat stat_buf;
+        this->is_pipe = fstat(fd, &stat_buf) == 0 && S_ISFIFO(stat_buf.st_mode);
+        this->newChunk();
+    }
+
+    ~PipeStreamBuf()
+    {
+        this->sync();
+        if (this->chunk)
+        {
+            munmap(this->chunk, PIPE_CHUNK_SIZE);
+        }
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (this->sync() == -1)
+        {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *this->pptr() = traits_type::to_char_type(c);
+            this->pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        const char *data = this->pbase();
+        size_t len = this->pptr() - this->pbase();
+        if (!this->chunk || len == 0)
+        {
+            return this->chunk ? 0 : -1;
+        }
+
+        bool full = len == PIPE_CHUNK_SIZE;
+        bool spliced_any = false;
+        while (this->is_pipe && full && len > 0)
+        {
+            struct iovec iov = {(void *)data, len};
+            ssize_t spliced = vmsplice(this->fd, &iov, 1, 0);
+            if (spliced == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            spliced_any = true;
+            data += spliced;
+            len -= spliced;
+        }
+        while (len > 0)
+        {
+            ssize_t written = write(this->fd, data, len);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("smash error: write failed");
+                return -1;
+            }
+            data += written;
+            len -= written;
+        }
+
+        if (spliced_any)
+        {
+            // the pipe still references these pages
+            munmap(this->chunk, PIPE_CHUNK_SIZE);
+            this->newChunk();
+        }
+        else
+        {
+            this->setp(this->chunk, this->chunk + PIPE_CHUNK_SIZE);
+        }
+        return this->chunk ? 0 : -1;
+    }
+
+private:
+    int fd;
+    bool is_pipe;
+    char *chunk;
+
+    void newChunk()
+    {
+        void *map = mmap(nullptr, PIPE_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            perror("smash error: mmap failed");
+            this->chunk = nullptr;
+            this->setp(nullptr, nullptr);
+            return;
+        }
+        this->chunk = (char *)map;
+        this->setp(this->chunk, this->chunk + PIPE_CHUNK_SIZE);
+    }
+};
+
+// Runs one pipeline stage inside its forked child. External commands exec
+// directly, so no extra smash process is left per stage.
+// pipe_fd is the standard stream that feeds the next stage, or -1 for the last stage.
+static void _runPipelineStage(const string &stage, int pipe_fd)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    Command *cmd = smash.CreateCommand(stage.c_str());
+    if (!cmd)
+    {
+        exit(1);
+    }
+
+    ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+    if (external && !external->is_background_command)
+    {
+        external->execInPlace();
+    }
+
+    // Builtins print through iostreams, which are pointed at the pipe while they run.
+    // Redirections write to their own file, so they are left alone.
+    if (pipe_fd == -1 || external || dynamic_cast<RedirectionCommand *>(cmd))
+    {
+        cmd->execute();
+        delete cmd;
+        cout.flush();
+        exit(0);
+    }
+
+    ostream &piped = (pipe_fd == STDERR_FILENO) ? cerr : cout;
+    piped.flush();
+    {
+        PipeStreamBuf pipe_buf(pipe_fd);
+        streambuf *original = piped.rdbuf(&pipe_buf);
+        cmd->execute();
+        delete cmd;
+        piped.flush();
+        piped.rdbuf(original);
+    }
+    cout.flush();
+    exit(0);
+}
+
+static void _closePipes(vector<int> &pipe_fds)
+{
+    for (int fd : pipe_fds)
+    {
+        if (close(fd) == -1)
+        {
+            perror("smash error: close failed");
+        }
+    }
+}
+
+void PipeCommand::execute()
+{
+    size_t count = stages.size();
+
+    // all N-1 pipes are created up front, pipe i connects stage i to stage i+1
+    vector<int> pipe_fds;
+    for (size_t i = 0; i + 1 < count; ++i)
+    {
+        int pipe_fd[2];
+        if (pipe(pipe_fd) == -1)
+        {
+            perror("smash error: pipe failed");
+            _closePipes(pipe_fds);
+            return;
+        }
+        pipe_fds.push_back(pipe_fd[0]);
+        pipe_fds.push_back(pipe_fd[1]);
+    }
+
+    SmallShell &smash = SmallShell::getInstance();
+    if (smash.pipe_size > 0)
+    {
+        for (size_t i = 1; i < pipe_fds.size(); i += 2)
+        {
+            if (fcntl(pipe_fds[i], F_SETPIPE_SZ, smash.pipe_size) == -1)
+            {
+                perror("smash error: fcntl failed");
+                break;
+            }
+        }
+    }
+    pid_t pgid = 0;
+    pid_t last_pid = -1;
+    vector<pid_t> pids;
+    size_t started = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("smash error: fork failed");
+            break;
+        }
+
+        if (pid == 0)
+        {
+            // Child: the first stage leads the process group, the rest join it
+            setpgid(0, pgid);
+            smash.events.resetInChild();
+            if (i > 0 && dup2(pipe_fds[2 * (i - 1)], STDIN_FILENO) == -1)
+            {
+                perror("smash error: dup2 failed");
+                exit(1);
+            }
+            // |& sends stderr into the pipe instead of stdout
+            if (i + 1 < count && dup2(pipe_fds[2 * i + 1], stderr_pipes[i] ? STDERR_FILENO : STDOUT_FILENO) == -1)
+            {
+                perror("smash error: dup2 failed");
+                exit(1);
+            }
+            _closePipes(pipe_fds);
+            _runPipelineStage(stages[i], i + 1 < count ? (stderr_pipes[i] ? STDERR_FILENO : STDOUT_FILENO) : -1);
+        }
+
+        // set it from the parent too, so the group exists before the next stage joins it
+        if (pgid == 0)
+        {
+            pgid = pid;
+        }
+        setpgid(pid, pgid);
+        last_pid = pid;
+        pids.push_back(pid);
+        started++;
+    }
+
+    // closing in the parent so the readers see EOF
+    _closePipes(pipe_fds);
+
+    if (started == 0)
+    {
+        return;
+    }
+
+    if (is_background_command)
+    {
+        smash.jobs.addJob(this, pids, false);
+        return;
+    }
+
+    // one reap loop for the whole group
+    smash.fg_pid = pgid;
+    for (size_t reaped = 0; reaped < started;)
+    {
+        int status;
+        struct rusage usage;
+        pid_t pid = smash.events.waitChild(-pgid, &status, 0, &usage);
+        if (pid == -1)
+        {
+            break;
+        }
+        smash.foreground_usage.add(usage);
+        // like other shells, a pipeline reports the status of its last stage
+        if (pid == last_pid)
+        {
+            smash.setWaitStatus(status);
+        }
+        reaped++;
+    }
+    smash.fg_pid = -1;
+}
+
+WhoAmICommand::WhoAmICommand(const char *cmd_line) : Command(cmd_line) {}
+void WhoAmICommand::execute()
+{
+    uid_t effectiveUserId = geteuid(); // Get the effective user ID
+    std::string username, homeDirectory;
+
+    // Retrieve username and home directory
+    this->fetchUserInfo(effectiveUserId, username, homeDirectory);
+
+    // Print the result
+    std::cout << username << " " << homeDirectory << std::endl;
+}
+
+void WhoAmICommand::fetchUserInfo(uid_t userId, std::string &username, std::string &homeDirectory)
+{
+    LineReader reader("/etc/passwd");
+    if (!reader.isOpen())
+    {
+        perror("smash error: open failed");
+        return;
+    }
+
+    const char *line;
+    size_t lineLength;
+    while (reader.next(line, lineLength))
+    {
+        // name:passwd:uid:gid:gecos:home:shell
+        const char *fields[6];
+        size_t lengths[6];
+        size_t field = 0, start = 0;
+        for (size_t i = 0; i <= lineLength && field < 6; ++i)
+        {
+            if (i == lineLength || line[i] == ':')
+            {
+                fields[field] = line + start;
+                lengths[field++] = i - start;
+                start = i + 1;
+            }
+        }
+        if (field < 6)
+        {
+            continue;
+        }
+
+        uid_t entryUid = (uid_t)strtoul(fields[2], nullptr, 10);
+        if (entryUid == userId)
+        {
+            username.assign(fields[0], lengths[0]);
+            homeDirectory.assign(fields[5], lengths[5]);
+            return;
+        }
+    }
+}
+
+#define DU_DENTS_SIZE (64 * 1024)
+
+struct DuDirent
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// A directory in flight. fd stays open while children still need to openat
+// against it (fd_refs), and the node lives until its whole subtree has been
+// added to total (pending).
+struct DuNode
+{
+    DuNode *parent;
+    std::string name;
+    int fd;
+    std::atomic<int> fd_refs;
+    std::atomic<int> pending;
+    std::atomic<long> total;
+
+    DuNode(DuNode *parent, const char *name)
+        : parent(parent), name(name), fd(-1), fd_refs(1), pending(1), total(0) {}
+};
+
+#define DU_RING_ENTRIES (256)
+
+// One io_uring per walker thread, used to stat a directory's entries in
+// batches of up to DU_RING_ENTRIES statx requests. Raw syscalls, the rings
+// are mapped by hand as liburing would.
+struct DuRing
+{
+    int fd;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+    bool broken; // io_uring_enter failed, stat synchronously from now on
+
+    const char *names[DU_RING_ENTRIES];
+    struct statx results[DU_RING_ENTRIES];
+};
+
+static void _closeRing(DuRing *ring)
+{
+    if (ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map)
+    {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    close(ring->fd);
+    delete ring;
+}
+
+// Does this kernel run IORING_OP_STATX? Asked once per process.
+static bool _ringHasStatx(int ring_fd)
+{
+    static int supported = -1;
+    if (supported != -1)
+    {
+        return supported;
+    }
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_size);
+    supported = 0;
+    if (probe && syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        supported = probe->last_op >= IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+// nullptr when io_uring is missing, disabled or lacks statx
+static DuRing *_openRing()
+{
+    // ENOSYS (old kernel or seccomp) and EPERM (io_uring_disabled sysctl)
+    // will not change, so later walks go straight to the sync path
+    static bool unavailable = false;
+    if (unavailable)
+    {
+        return nullptr;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, DU_RING_ENTRIES, &params);
+    if (fd == -1)
+    {
+        unavailable = errno == ENOSYS || errno == EPERM;
+        return nullptr;
+    }
+    DuRing *ring = new DuRing();
+    memset(ring, 0, offsetof(DuRing, names));
+    ring->fd = fd;
+    if (!_ringHasStatx(fd))
+    {
+        _closeRing(ring);
+        return nullptr;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map)
+    {
+        ring->sq_map_size = ring->cq_map_size = std::max(ring->sq_map_size, ring->cq_map_size);
+    }
+    ring->sq_map = mmap(nullptr, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = nullptr;
+        _closeRing(ring);
+        return nullptr;
+    }
+    ring->cq_map = single_map ? ring->sq_map
+                              : mmap(nullptr, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED)
+    {
+        ring->cq_map = nullptr;
+        _closeRing(ring);
+        return nullptr;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = nullptr;
+        _closeRing(ring);
+        return nullptr;
+    }
+
+    char *sq = (char *)ring->sq_map;
+    char *cq = (char *)ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->entries = std::min(params.sq_entries, (unsigned)DU_RING_ENTRIES);
+    return ring;
+}
+
+static void _statxToStat(const struct statx &stx, struct stat &st)
+{
+    memset(&st, 0, sizeof(st));
+    st.st_mode = stx.stx_mode;
+    st.st_nlink = stx.stx_nlink;
+    st.st_ino = stx.stx_ino;
+    st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st.st_blocks = stx.stx_blocks;
+}
+
+// Per-thread deque: the owner pushes and pops at the back (depth first),
+// idle workers steal from the front.
+struct DuWorker
+{
+    std::mutex lock;
+    std::deque<DuNode *> nodes;
+    std::vector<std::pair<DuCacheKey, DuCacheEntry>> updates; // directories seen, merged into the new cache
+    DuRing *ring;                                             // nullptr for the synchronous backend
+    char dents[DU_DENTS_SIZE];
+};
+
+// What one directory listing adds up to
+struct DuListing
+{
+    const struct stat *dir_stat; // nullptr if the directory could not be stat'ed
+    long files_kb;
+    long linked_kb;
+    std::string subdirs;
+    std::string links;
+};
+
+#define INODE_SET_INITIAL (1024)
+
+static uint64_t _mixInode(uint64_t dev, uint64_t ino)
+{
+    // splitmix64 finalizer
+    uint64_t x = ino ^ (dev * 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+InodeSet::InodeSet()
+{
+    for (int i = 0; i < INODE_SET_SHARDS; ++i)
+    {
+        this->shards[i].slots = nullptr;
+        this->shards[i].mask = 0;
+        this->shards[i].used = 0;
+    }
+}
+
+InodeSet::~InodeSet()
+{
+    this->clear();
+}
+
+void InodeSet::clear()
+{
+    for (int i = 0; i < INODE_SET_SHARDS; ++i)
+    {
+        free(this->shards[i].slots);
+        this->shards[i].slots = nullptr;
+        this->shards[i].mask = 0;
+        this->shards[i].used = 0;
+    }
+}
+
+size_t InodeSet::size()
+{
+    size_t total = 0;
+    for (int i = 0; i < INODE_SET_SHARDS; ++i)
+    {
+        std::lock_guard<std::mutex> guard(this->shards[i].lock);
+        total += this->shards[i].used;
+    }
+    return total;
+}
+
+void InodeSet::grow(Shard &shard)
+{
+    size_t capacity = shard.slots ? (shard.mask + 1) * 2 : INODE_SET_INITIAL;
+    Slot *slots = (Slot *)calloc(capacity, sizeof(Slot));
+    if (!slots)
+    {
+        return;
+    }
+    size_t mask = capacity - 1;
+    for (size_t i = 0; shard.slots && i <= shard.mask; ++i)
+    {
+        Slot &old_slot = shard.slots[i];
+        if (old_slot.ino == 0)
+        {
+            continue;
+        }
+        size_t pos = _mixInode(old_slot.dev, old_slot.ino) & mask;
+        while (slots[pos].ino != 0)
+        {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos] = old_slot;
+    }
+    free(shard.slots);
+    shard.slots = slots;
+    shard.mask = mask;
+}
+
+bool InodeSet::insert(dev_t dev, ino_t ino)
+{
+    uint64_t hash = _mixInode(dev, ino);
+    // Top bits pick the shard, low bits the slot inside it
+    Shard &shard = this->shards[hash >> 58];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    // Keep the load under 3/4
+    if (!shard.slots || (shard.used + 1) * 4 > (shard.mask + 1) * 3)
+    {
+        grow(shard);
+        if (!shard.slots || shard.used == shard.mask + 1)
+        {
+            // Out of memory, counting twice beats failing du
+            return true;
+        }
+    }
+    size_t pos = hash & shard.mask;
+    while (shard.slots[pos].ino != 0)
+    {
+        if (shard.slots[pos].ino == ino && shard.slots[pos].dev == (uint64_t)dev)
+        {
+            return false;
+        }
+        pos = (pos + 1) & shard.mask;
+    }
+    shard.slots[pos].dev = dev;
+    shard.slots[pos].ino = ino;
+    shard.used++;
+    return true;
+}
+
+static void _releaseDirFd(DuNode *node)
+{
+    if (node->fd_refs.fetch_sub(1) == 1 && node->fd != -1)
+    {
+        close(node->fd);
+        node->fd = -1;
+    }
+}
+
+DiskUsageWalker::DiskUsageWalker(int threads)
+    : thread_count(threads), queued(0), sleepers(0), done(false), previous(nullptr), recording(false)
+{
+    if (this->thread_count <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        this->thread_count = cpus > 0 ? (int)cpus : 1;
+    }
+}
+
+void DiskUsageWalker::push(DuWorker *self, DuNode *node)
+{
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->nodes.push_back(node);
+    }
+    this->queued.fetch_add(1);
+    if (this->sleepers.load() > 0)
+    {
+        // A sleeper holds idle_lock from its check until it waits, so taking
+        // the lock here means the notify cannot slip in between
+        std::lock_guard<std::mutex> guard(this->idle_lock);
+        this->idle_cond.notify_one();
+    }
+}
+
+DuNode *DiskUsageWalker::take(DuWorker *self)
+{
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (!self->nodes.empty())
+        {
+            DuNode *node = self->nodes.back();
+            self->nodes.pop_back();
+            this->queued.fetch_sub(1);
+            return node;
+        }
+    }
+    size_t count = this->workers.size();
+    size_t index = std::find(this->workers.begin(), this->workers.end(), self) - this->workers.begin();
+    for (size_t i = 1; i < count; ++i)
+    {
+        DuWorker *victim = this->workers[(index + i) % count];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->nodes.empty())
+        {
+            DuNode *node = victim->nodes.front();
+            victim->nodes.pop_front();
+            this->queued.fetch_sub(1);
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+void DiskUsageWalker::work(DuWorker *self)
+{
+    while (true)
+    {
+        DuNode *node = this->take(self);
+        if (node)
+        {
+            this->process(self, node);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(this->idle_lock);
+        this->sleepers.fetch_add(1);
+        while (this->queued.load() == 0 && !this->done.load())
+        {
+            this->idle_cond.wait(guard);
+        }
+        this->sleepers.fetch_sub(1);
+        if (this->done.load())
+        {
+            return;
+        }
+    }
+}
+
+// Called once a node's own listing is over and again for every child that
+// completes; the last call adds the subtree to the parent and walks upwards.
+void DiskUsageWalker::finish(DuNode *node)
+{
+    while (node->pending.fetch_sub(1) == 1)
+    {
+        DuNode *parent = node->parent;
+        if (this->stream || this->top > 0)
+        {
+            this->report(node, node->total.load());
+        }
+        if (!parent)
+        {
+            std::lock_guard<std::mutex> guard(this->idle_lock);
+            this->done.store(true);
+            this->idle_cond.notify_all();
+            return;
+        }
+        parent->total.fetch_add(node->total.load());
+        delete node;
+        node = parent;
+    }
+}
+
+static bool _heavierFirst(const std::pair<long, std::string> &a, const std::pair<long, std::string> &b)
+{
+    return a.first > b.first;
+}
+
+// Full path of a directory in flight, its ancestors are all still alive
+static std::string _duPath(DuNode *node)
+{
+    if (!node->parent)
+    {
+        return node->name;
+    }
+    std::string path = _duPath(node->parent);
+    if (path.empty() || path[path.size() - 1] != '/')
+    {
+        path += '/';
+    }
+    return path + node->name;
+}
+
+void DiskUsageWalker::report(DuNode *node, long kb)
+{
+    std::lock_guard<std::mutex> guard(this->report_lock);
+    if (this->top > 0)
+    {
+        // Only pay for the path when the directory makes it into the heap
+        if (this->top_heap.size() < this->top || kb > this->top_heap.front().first)
+        {
+            if (this->top_heap.size() == this->top)
+            {
+                std::pop_heap(this->top_heap.begin(), this->top_heap.end(), _heavierFirst);
+                this->top_heap.pop_back();
+            }
+            this->top_heap.push_back(std::make_pair(kb, _duPath(node)));
+            std::push_heap(this->top_heap.begin(), this->top_heap.end(), _heavierFirst);
+        }
+    }
+    if (this->stream)
+    {
+        cout << kb << "\t" << _duPath(node) << "\n";
+        // Flush a few times a second rather than once per directory
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - this->last_flush >= std::chrono::milliseconds(200) || !node->parent)
+        {
+            cout.flush();
+            this->last_flush = now;
+        }
+    }
+}
+
+std::vector<std::pair<long, std::string>> DiskUsageWalker::heaviest()
+{
+    std::vector<std::pair<long, std::string>> sorted(this->top_heap);
+    std::sort(sorted.begin(), sorted.end(), _heavierFirst);
+    return sorted;
+}
+
+long DiskUsageWalker::linkedKb(uint64_t dev, uint64_t ino, long kb)
+{
+    if (this->one_filesystem && dev != (uint64_t)this->root_dev)
+    {
+        return 0;
+    }
+    if (!this->count_links && !this->inodes.insert(dev, ino))
+    {
+        return 0;
+    }
+    return kb;
+}
+
+void DiskUsageWalker::process(DuWorker *self, DuNode *node)
+{
+    struct stat stat_buf;
+    if (node->parent)
+    {
+        DuNode *parent = node->parent;
+        // du -x: look before opening, so other mounts are never entered
+        if (this->one_filesystem &&
+            fstatat(parent->fd, node->name.c_str(), &stat_buf, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) == 0 &&
+            stat_buf.st_dev != this->root_dev)
+        {
+            _releaseDirFd(parent);
+            this->finish(node);
+            return;
+        }
+        node->fd = openat(parent->fd, node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (node->fd == -1)
+        {
+            // Still count the directory itself, as lstat + opendir would
+            perror("smash error: openat failed");
+            if (fstatat(parent->fd, node->name.c_str(), &stat_buf, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                node->total.fetch_add(stat_buf.st_blocks / 2);
+            }
+            _releaseDirFd(parent);
+            this->finish(node);
+            return;
+        }
+        _releaseDirFd(parent);
+    }
+
+    struct stat dir_stat;
+    bool have_stat = fstat(node->fd, &dir_stat) == 0;
+    if (!have_stat)
+    {
+        perror("smash error: fstat failed");
+    }
+    long total = have_stat ? dir_stat.st_blocks / 2 : 0;
+
+    const DuCacheEntry *cached = have_stat && this->previous ? this->previous->lookup(dir_stat) : nullptr;
+    if (cached)
+    {
+        // Unchanged since the last run, only the subdirectories need a visit
+        const char *name = cached->subdirs.data();
+        const char *names_end = name + cached->subdirs.size();
+        for (; name < names_end; name += strlen(name) + 1)
+        {
+            node->pending.fetch_add(1);
+            node->fd_refs.fetch_add(1);
+            this->push(self, new DuNode(node, name));
+        }
+        total += cached->files_kb;
+        for (size_t pos = 0; pos + sizeof(DuCacheLink) <= cached->links.size(); pos += sizeof(DuCacheLink))
+        {
+            DuCacheLink link;
+            memcpy(&link, cached->links.data() + pos, sizeof(link));
+            total += this->linkedKb(link.dev, link.ino, link.kb);
+        }
+        if (this->recording)
+        {
+            DuCacheKey key = {dir_stat.st_dev, dir_stat.st_ino};
+            self->updates.push_back(std::make_pair(key, *cached));
+        }
+        node->total.fetch_add(total);
+        _releaseDirFd(node);
+        this->finish(node);
+        return;
+    }
+
+    DuListing listing;
+    listing.dir_stat = have_stat ? &dir_stat : nullptr;
+    listing.files_kb = 0;
+    listing.linked_kb = 0;
+    bool batched = self->ring && !self->ring->broken;
+    while (true)
+    {
+        long bytes = syscall(SYS_getdents64, node->fd, self->dents, DU_DENTS_SIZE);
+        if (bytes == 0)
+        {
+            break;
+        }
+        if (bytes < 0)
+        {
+            perror("smash error: getdents64 failed");
+            // A partial listing must not end up in the cache
+            have_stat = false;
+            break;
+        }
+        unsigned queued_stats = 0;
+        for (long pos = 0; pos < bytes;)
+        {
+            DuDirent *entry = (DuDirent *)(self->dents + pos);
+            pos += entry->d_reclen;
+            const char *name = entry->d_name;
+
+            // Skip "." and ".."
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+
+            if (entry->d_type == DT_DIR)
+            {
+                this->addSubdir(self, node, listing, name);
+                continue;
+            }
+            if (batched)
+            {
+                // The names point into dents, which stays put until the batch is done
+                self->ring->names[queued_stats++] = name;
+                if (queued_stats == self->ring->entries)
+                {
+                    this->statBatch(self, node, listing, queued_stats);
+                    queued_stats = 0;
+                }
+                continue;
+            }
+            if (fstatat(node->fd, name, &stat_buf, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                perror("smash error: fstatat failed");
+                continue;
+            }
+            this->addEntry(self, node, listing, name, stat_buf);
+        }
+        if (queued_stats > 0)
+        {
+            this->statBatch(self, node, listing, queued_stats);
+        }
     }
 
-    if (WIFEXITED(status) || WIFSIGNALED(status))
+    if (this->recording && have_stat)
     {
-        jobs->removeJobById(job_id);
+        DuCacheKey key = {dir_stat.st_dev, dir_stat.st_ino};
+        DuCacheEntry fresh = {dir_stat.st_mtim, dir_stat.st_ctim, listing.files_kb, listing.subdirs, listing.links};
+        self->updates.push_back(std::make_pair(key, fresh));
     }
-    else if (WIFSTOPPED(status))
-    {
-        job->stopped = true;
-    }
-
-    smash.fg_pid = -1;
-}
-
-void JobsCommand::execute()
-{
-    this->jobs->printJobsList();
-}
-
-JobsList::JobsList() : next(1) {}
-
-void JobsList::addJob(Command *cmd, pid_t pid, bool stopped)
-{
-    removeFinishedJobs();
-    int job_id = next++;
-    jobs.emplace(job_id, JobEntry(job_id, pid, cmd->cmd_line, stopped));
+    node->total.fetch_add(total + listing.files_kb + listing.linked_kb);
+    _releaseDirFd(node);
+    this->finish(node);
 }
 
-void JobsList::printJobsList()
+void DiskUsageWalker::addSubdir(DuWorker *self, DuNode *node, DuListing &listing, const char *name)
 {
-    removeFinishedJobs(); // Ensure finished jobs are not printed
-    for (const auto &pair : jobs)
+    node->pending.fetch_add(1);
+    node->fd_refs.fetch_add(1);
+    this->push(self, new DuNode(node, name));
+    if (this->recording)
     {
-        const JobEntry &job = pair.second;
-        std::cout << "[" << job.job_id << "] " << job.command << std::endl;
+        listing.subdirs.append(name, strlen(name) + 1);
     }
 }
 
-void JobsList::killAllJobs()
+void DiskUsageWalker::addEntry(DuWorker *self, DuNode *node, DuListing &listing, const char *name,
+                               const struct stat &entry_stat)
 {
-    removeFinishedJobs();
-    cout << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:" << endl;
-    for (const auto &pair : jobs)
+    // DT_UNKNOWN on filesystems that do not fill d_type
+    if (S_ISDIR(entry_stat.st_mode))
     {
-        const JobEntry &job = pair.second;
-        cout << job.pid << ": " << job.command << endl;
-        int _res = kill(job.pid, SIGKILL);
-
-        if (_res == -1)
+        this->addSubdir(self, node, listing, name);
+        return;
+    }
+    long kb = entry_stat.st_blocks / 2; // Convert blocks to kilobytes (512 bytes per block)
+    if (entry_stat.st_nlink > 1 || (listing.dir_stat && entry_stat.st_dev != listing.dir_stat->st_dev))
+    {
+        // May be met again through another link or mount, decided per run
+        DuCacheLink link = {(uint64_t)entry_stat.st_dev, (uint64_t)entry_stat.st_ino, kb};
+        if (this->recording)
         {
-            perror("smash error: kill failed");
-            return;
+            listing.links.append((const char *)&link, sizeof(link));
         }
+        listing.linked_kb += this->linkedKb(link.dev, link.ino, kb);
+        return;
     }
-    jobs.clear();
+    listing.files_kb += kb;
 }
 
-void JobsList::removeFinishedJobs()
+// Stats ring->names[0..count) relative to node's fd with one submission,
+// then waits for all of them
+void DiskUsageWalker::statBatch(DuWorker *self, DuNode *node, DuListing &listing, unsigned count)
 {
-    int status;
-    pid_t curr_job_id;
-    SmallShell &smash = SmallShell::getInstance();
-    for (auto it = jobs.begin(); it != jobs.end();)
+    DuRing *ring = self->ring;
+    unsigned tail = *ring->sq_tail;
+    // A ring that broke earlier in this directory only takes the plain path below
+    for (unsigned i = 0; !ring->broken && i < count; ++i)
     {
-        curr_job_id = waitpid(it->second.pid, &status, WNOHANG);
-        if (curr_job_id == -1 || (!it->second.stopped && curr_job_id > 0))
+        unsigned index = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = node->fd;
+        sqe->addr = (uint64_t)ring->names[i];
+        sqe->len = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_BLOCKS;
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+        sqe->off = (uint64_t)&ring->results[i];
+        sqe->user_data = i;
+        ring->sq_array[index] = index;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    // Once broken, only wait for what the kernel already took: those still
+    // write into ring->results and read ring->names. If io_uring_enter cannot
+    // even wait, the completion ring is watched by hand until they are in.
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    bool polling = false;
+    std::vector<bool> done_names(count, false);
+    while (completed < (ring->broken ? submitted : count))
+    {
+        unsigned to_submit = ring->broken ? 0 : count - submitted;
+        long entered = polling ? 0 : syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS,
+                                             nullptr, 0);
+        if (entered < 0)
         {
-            if (it->second.pid == smash.fg_pid)
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("smash error: io_uring_enter failed");
+            if (ring->broken)
             {
-                smash.fg_pid = -1;
+                polling = true;
+                continue;
             }
-            it = jobs.erase(it);
+            ring->broken = true;
+            // take back the entries the kernel has not read
+            __atomic_store_n(ring->sq_tail, tail - (count - submitted), __ATOMIC_RELEASE);
+            continue;
         }
-        else
+        submitted += entered;
+
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; ++head)
         {
-            ++it;
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned i = (unsigned)cqe->user_data;
+            completed++;
+            done_names[i] = true;
+            if (cqe->res < 0)
+            {
+                errno = -cqe->res;
+                perror("smash error: statx failed");
+                continue;
+            }
+            struct stat entry_stat;
+            _statxToStat(ring->results[i], entry_stat);
+            this->addEntry(self, node, listing, ring->names[i], entry_stat);
         }
+        if (polling && head == *ring->cq_head)
+        {
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, nullptr);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
     }
-    if (!jobs.empty())
-    {
-        next = (--jobs.end())->first + 1;
-    }
-    else
+
+    // The ring gave up half way, finish the batch the plain way
+    for (unsigned i = 0; ring->broken && i < count; ++i)
     {
-        next = 1;
+        struct stat entry_stat;
+        if (done_names[i])
+        {
+            continue;
+        }
+        if (fstatat(node->fd, ring->names[i], &entry_stat, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            perror("smash error: fstatat failed");
+            continue;
+        }
+        this->addEntry(self, node, listing, ring->names[i], entry_stat);
     }
 }
 
-JobsList::JobEntry *JobsList::getJobById(int jobId)
+long DiskUsageWalker::walk(const char *path, const DuCache *previous, DuCache *updated)
 {
-    removeFinishedJobs();
-    auto it = jobs.find(jobId);
-    if (it != jobs.end())
+    struct stat stat_buf;
+    if (lstat(path, &stat_buf) == -1)
     {
-        return &(it->second);
+        perror("smash error: lstat failed");
+        return 0;
+    }
+    if (!S_ISDIR(stat_buf.st_mode))
+    {
+        return stat_buf.st_blocks / 2;
     }
-    return nullptr;
-}
 
-void JobsList::removeJobById(int jobId)
-{
-    jobs.erase(jobId);
-    if (!jobs.empty())
+    // The root's own size is added by process() from its fstat
+    DuNode root(nullptr, path);
+    root.fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root.fd == -1)
     {
-        next = (--jobs.end())->first + 1;
+        perror("smash error: opendir failed");
+        return stat_buf.st_blocks / 2;
     }
-    else
+    this->previous = previous;
+    this->recording = updated != nullptr;
+    this->root_dev = stat_buf.st_dev;
+    this->inodes.clear();
+    this->top_heap.clear();
+    this->last_flush = std::chrono::steady_clock::now();
+
+    // Directories waiting in the deques keep their parent open, allow as
+    // many fds as the hard limit does while the walk runs
+    struct rlimit saved_limit;
+    bool raised = _raiseFdLimit(&saved_limit);
+
+    this->done.store(false);
+    this->uring_used = false;
+    for (int i = 0; i < this->thread_count; ++i)
     {
-        next = 1;
+        DuWorker *worker = new DuWorker();
+        // The first ring that cannot be set up means no rings at all
+        worker->ring = this->use_uring && (i == 0 || this->uring_used) ? _openRing() : nullptr;
+        this->uring_used = worker->ring != nullptr;
+        this->workers.push_back(worker);
     }
-}
+    this->push(this->workers[0], &root);
 
-JobsList::JobEntry *JobsList::getLastJob(int *lastJobId)
-{
-    removeFinishedJobs();
-    if (jobs.empty())
+    // The calling thread is worker 0, the rest get their own threads
+    std::vector<std::thread> threads;
+    for (int i = 1; i < this->thread_count; ++i)
     {
-        return nullptr;
+        threads.push_back(std::thread(&DiskUsageWalker::work, this, this->workers[i]));
     }
-    auto it = --jobs.end();
-    if (lastJobId)
+    this->work(this->workers[0]);
+    for (size_t i = 0; i < threads.size(); ++i)
     {
-        *lastJobId = it->first;
+        threads[i].join();
     }
-    return &(it->second);
-}
 
-JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId)
-{
-    removeFinishedJobs();
-    int max = -1;
-    for (const auto &job : jobs)
+    for (size_t i = 0; i < this->workers.size(); ++i)
     {
-        if (job.second.stopped && job.first > max)
+        if (updated)
         {
-            max = job.first;
+            std::vector<std::pair<DuCacheKey, DuCacheEntry>> &updates = this->workers[i]->updates;
+            for (size_t j = 0; j < updates.size(); ++j)
+            {
+                updated->entries[updates[j].first] = std::move(updates[j].second);
+            }
         }
+        if (this->workers[i]->ring)
+        {
+            _closeRing(this->workers[i]->ring);
+        }
+        delete this->workers[i];
     }
-    if (max == -1)
-    {
-        return nullptr;
-    }
-    if (jobId)
+    this->workers.clear();
+    if (raised)
     {
-        *jobId = max;
+        setrlimit(RLIMIT_NOFILE, &saved_limit);
     }
-    return &(jobs.find(max)->second);
+    return root.total.load();
 }
 
-std::list<std::pair<std::string, std::string>> &SmallShell::getAliases()
-{
-    return this->alias_list;
-}
+#define DU_CACHE_MAGIC "SMASHDU2"
 
-unordered_map<string, string> &SmallShell::getAliasesMap()
+// On-disk layout of one cache entry, followed by subdirs_len bytes of names
+// and links_len bytes of DuCacheLink records
+struct DuCacheRecord
 {
-    return this->aliases;
-}
-
-bool SmallShell::isReservedCommand(const string &command) const
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    int64_t files_kb;
+    uint64_t subdirs_len;
+    uint64_t links_len;
+};
+
+static bool _sameTime(const struct timespec &a, const struct timespec &b)
 {
-    return this->reserved.find(command) != this->reserved.end();
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
 }
 
-PipeCommand::PipeCommand(const std::string &cmd_line, const std::string &part1, const std::string &part2, bool is_stderr) : Command(cmd_line.c_str()), cmd1(part1), cmd2(part2), is_stderr(is_stderr) {}
-
-void PipeCommand::execute()
+const DuCacheEntry *DuCache::lookup(const struct stat &dir_stat) const
 {
-
-    int pipe_fd[2];
-
-    // creating a pipe object with syscall
-    if (pipe(pipe_fd) == -1)
+    DuCacheKey key = {dir_stat.st_dev, dir_stat.st_ino};
+    auto it = this->entries.find(key);
+    if (it == this->entries.end())
     {
-        perror("smash error: pipe failed");
-        return;
+        return nullptr;
     }
+    const DuCacheEntry &entry = it->second;
+    if (!_sameTime(entry.mtime, dir_stat.st_mtim) || !_sameTime(entry.ctime, dir_stat.st_ctim))
+    {
+        return nullptr;
+    }
+    return &entry;
+}
 
-    SmallShell &smash = SmallShell::getInstance();
-    pid_t pid1 = fork();
-
-    if (pid1 == -1)
+void DuCache::load(const char *path)
+{
+    MappedFile file;
+    size_t magic_len = strlen(DU_CACHE_MAGIC);
+    if (!file.open(path) || file.size < magic_len || memcmp(file.data, DU_CACHE_MAGIC, magic_len) != 0)
     {
-        perror("smash error: fork failed");
         return;
     }
-
-    if (pid1 == 0)
+    size_t pos = magic_len;
+    while (file.size - pos >= sizeof(DuCacheRecord))
     {
-        // Child
-        setpgrp();
-        if (close(pipe_fd[0]) == -1)
-        {
-            perror("smash error: close failed");
-            exit(1);
-        }
-
-        // 1 is for write end in the pipe
-        // redirects out/err to the pipe
-        // dup2 for closing the fd to make sure other reads will end
-        if (dup2(pipe_fd[1], is_stderr ? STDERR_FILENO : STDOUT_FILENO) == -1)
-        {
-            perror("smash error: dup2 failed");
-            exit(1);
-        }
-
-        if (close(pipe_fd[1]) == -1)
+        DuCacheRecord record;
+        memcpy(&record, file.data + pos, sizeof(record));
+        pos += sizeof(record);
+        if (record.subdirs_len > file.size - pos || record.links_len > file.size - pos - record.subdirs_len)
         {
-            perror("smash error: close failed");
-            exit(1);
+            // Truncated file, keep what was complete
+            break;
         }
+        DuCacheKey key = {(dev_t)record.dev, (ino_t)record.ino};
+        DuCacheEntry &entry = this->entries[key];
+        entry.mtime.tv_sec = record.mtime_sec;
+        entry.mtime.tv_nsec = record.mtime_nsec;
+        entry.ctime.tv_sec = record.ctime_sec;
+        entry.ctime.tv_nsec = record.ctime_nsec;
+        entry.files_kb = record.files_kb;
+        entry.subdirs.assign(file.data + pos, record.subdirs_len);
+        pos += record.subdirs_len;
+        entry.links.assign(file.data + pos, record.links_len);
+        pos += record.links_len;
+    }
+}
 
-        // Execute
-        Command *cmd1 = smash.CreateCommand(this->cmd1.c_str());
-        if (cmd1)
+static bool _writeAll(int fd, std::string &buffer)
+{
+    size_t done = 0;
+    while (done < buffer.size())
+    {
+        ssize_t written = write(fd, buffer.data() + done, buffer.size() - done);
+        if (written == -1)
         {
-            cmd1->execute();
-            delete cmd1;
-            exit(0);
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
         }
-        exit(1);
+        done += written;
     }
+    buffer.clear();
+    return true;
+}
 
-    pid_t pid2 = fork();
-    if (pid2 == -1)
+bool DuCache::save(const char *path, const struct timespec &since) const
+{
+    // Written next to the old file and renamed over it, so a crash or a
+    // concurrent du never sees half a cache
+    std::string temp_path = std::string(path) + "." + std::to_string(getpid());
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
     {
-        perror("smash error: fork failed");
-        return;
+        return false;
     }
 
-    if (pid2 == 0)
+    std::string buffer(DU_CACHE_MAGIC);
+    bool ok = true;
+    for (auto it = this->entries.begin(); ok && it != this->entries.end(); ++it)
     {
-        // Child
-        setpgrp();
-
-        // this process child should not have the write fd to the pipe so we close it
-        if (close(pipe_fd[1]) == -1)
-        {
-            perror("smash error: close failed");
-            exit(1);
-        }
-
-        // Again like before
-        if (dup2(pipe_fd[0], STDIN_FILENO) == -1)
+        const DuCacheEntry &entry = it->second;
+        if (entry.mtime.tv_sec >= since.tv_sec - 1 || entry.ctime.tv_sec >= since.tv_sec - 1)
         {
-            perror("smash error: dup2 failed");
-            exit(1);
-        }
-
-        if (close(pipe_fd[0]) == -1)
-        {
-            perror("smash error: close failed");
-            exit(1);
+            continue;
         }
-
-        // Execute
-        Command *cmd2 = smash.CreateCommand(this->cmd2.c_str());
-        if (cmd2)
+        DuCacheRecord record = {(uint64_t)it->first.dev, (uint64_t)it->first.ino,
+                                (int64_t)entry.mtime.tv_sec, (int64_t)entry.mtime.tv_nsec,
+                                (int64_t)entry.ctime.tv_sec, (int64_t)entry.ctime.tv_nsec,
+                                (int64_t)entry.files_kb, (uint64_t)entry.subdirs.size(),
+                                (uint64_t)entry.links.size()};
+        buffer.append((const char *)&record, sizeof(record));
+        buffer.append(entry.subdirs);
+        buffer.append(entry.links);
+        if (buffer.size() >= (1 << 20))
         {
-            cmd2->execute();
-            delete cmd2;
-            exit(0);
+            ok = _writeAll(fd, buffer);
         }
-        exit(1);
     }
-
-    // closing in the parent
-    if (close(pipe_fd[0]) == -1)
+    ok = ok && _writeAll(fd, buffer);
+    if (close(fd) == -1)
     {
-        perror("smash error: close failed");
+        ok = false;
     }
-
-    if (close(pipe_fd[1]) == -1)
+    if (!ok || rename(temp_path.c_str(), path) == -1)
     {
-        perror("smash error: close failed");
+        unlink(temp_path.c_str());
+        return false;
     }
-
-    // wait both the childs to finish and see the out of the cmd2 child
-    waitpid(pid1, nullptr, 0);
-    waitpid(pid2, nullptr, 0);
-}
-
-WhoAmICommand::WhoAmICommand(const char *cmd_line) : Command(cmd_line) {}
-void WhoAmICommand::execute()
-{
-    uid_t effectiveUserId = geteuid(); // Get the effective user ID
-    std::string username, homeDirectory;
-
-    // Retrieve username and home directory
-    this->fetchUserInfo(effectiveUserId, username, homeDirectory);
-
-    // Print the result
-    std::cout << username << " " << homeDirectory << std::endl;
+    return true;
 }
 
-void WhoAmICommand::fetchUserInfo(uid_t userId, std::string &username, std::string &homeDirectory)
+// Cache file for the tree rooted at root_stat: $SMASH_DU_CACHE (empty turns
+// the cache off), else $XDG_CACHE_HOME/smash, else ~/.cache/smash
+static bool _duCachePath(const struct stat &root_stat, std::string &cache_path)
 {
-    int passwdFileDescriptor = open("/etc/passwd", O_RDONLY);
-    if (passwdFileDescriptor == -1)
+    std::string dir;
+    const char *env = getenv("SMASH_DU_CACHE");
+    if (env)
     {
-        perror("smash error: open failed");
-        return;
+        dir = env;
     }
-
-    char buffer[4096];
-    ssize_t bytesRead = 0;
-    std::string leftoverData;
-
-    while ((bytesRead = read(passwdFileDescriptor, buffer, sizeof(buffer))) > 0)
+    else if ((env = getenv("XDG_CACHE_HOME")) && *env)
     {
-        string data(buffer, bytesRead);
-        leftoverData += data;
-
-        size_t lineEnd = 0;
-        while ((lineEnd = leftoverData.find('\n')) != std::string::npos)
-        {
-            std::string line = leftoverData.substr(0, lineEnd);
-            leftoverData = leftoverData.substr(lineEnd + 1);
-
-            std::string user, uidStr, home;
-            size_t field = 0, start = 0;
-            uid_t entryUid = -1;
-
-            for (size_t i = 0; i <= line.size(); ++i)
-            {
-                if (i == line.size() || line[i] == ':')
-                {
-                    std::string fieldValue = line.substr(start, i - start);
-                    start = i + 1;
-
-                    switch (field++)
-                    {
-                    case 0:
-                        user = fieldValue; // Username
-                        break;
-                    case 2:
-                        uidStr = fieldValue; // UID
-                        entryUid = std::stoi(uidStr);
-                        break;
-                    case 5:
-                        home = fieldValue; // Home directory
-                        break;
-                    }
-                }
-            }
-
-            if (entryUid == userId)
-            {
-                username = user;
-                homeDirectory = home;
-                if (close(passwdFileDescriptor) == -1)
-                {
-                    perror("smash error: close failed");
-                }
-                passwdFileDescriptor = -1;
-                return;
-            }
-        }
+        dir = std::string(env) + "/smash";
     }
-
-    if (bytesRead == -1)
+    else if ((env = getenv("HOME")) && *env)
+    {
+        dir = std::string(env) + "/.cache/smash";
+    }
+    if (dir.empty())
     {
-        perror("smash error: read failed");
+        return false;
     }
 
-    if (passwdFileDescriptor != -1)
+    // mkdir -p
+    for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1))
     {
-        if (close(passwdFileDescriptor) == -1)
+        std::string prefix = dir.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) == -1 && errno != EEXIST)
         {
-            perror("smash error: close failed");
+            return false;
+        }
+        if (slash == std::string::npos)
+        {
+            break;
         }
-        passwdFileDescriptor = -1;
     }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/du-%lx-%lx", (unsigned long)root_stat.st_dev, (unsigned long)root_stat.st_ino);
+    cache_path = dir + name;
+    return true;
 }
 
-long calculateDiskUsage(const std::string &path)
+void DuCommand::execute()
 {
-    struct stat stat_buf;
-    if (lstat(path.c_str(), &stat_buf) == -1)
+    bool cache = false;
+    bool rebuild = false;
+    DiskUsageWalker walker;
+    // io_uring when the kernel has it, SMASH_DU_BACKEND=sync keeps du off it
+    const char *backend = getenv("SMASH_DU_BACKEND");
+    if (backend && strcmp(backend, "sync") == 0)
     {
-        perror("smash error: lstat failed");
-        return 0;
+        walker.use_uring = false;
     }
-
-    // Add the size of the current file/directory
-    long total_size = stat_buf.st_blocks / 2; // Convert blocks to kilobytes (512 bytes per block)
-
-    // If it's a directory, recursively calculate the size of its contents
-    if (S_ISDIR(stat_buf.st_mode))
+    else if (backend && strcmp(backend, "uring") != 0)
+    {
+        cerr << "smash error: unknown SMASH_DU_BACKEND " << backend << endl;
+    }
+    int dir_args = 0;
+    string dir;
+    for (int i = 1; i < this->args_count; ++i)
     {
-        DIR *dir = opendir(path.c_str());
-        if (!dir)
+        const char *arg = this->args[i];
+        if (strcmp(arg, "--cache") == 0)
         {
-            perror("smash error: opendir failed");
-            return total_size;
+            cache = true;
+            continue;
         }
-
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != nullptr)
+        if (strcmp(arg, "--rebuild") == 0)
         {
-            std::string name = entry->d_name;
-
-            // Skip "." and ".."
-            if (name == "." || name == "..")
+            cache = true;
+            rebuild = true;
+            continue;
+        }
+        if (strcmp(arg, "--stream") == 0)
+        {
+            walker.stream = true;
+            continue;
+        }
+        if (strcmp(arg, "--top") == 0)
+        {
+            char *end = nullptr;
+            long count = i + 1 < this->args_count ? strtol(this->args[i + 1], &end, 10) : 0;
+            if (count <= 0 || *end != '\0')
             {
-                continue;
+                cerr << "smash error: du: invalid arguments" << endl;
+                return;
             }
-
-            std::string full_path = path + "/" + name;
-            total_size += calculateDiskUsage(full_path);
+            walker.top = count;
+            i++;
+            continue;
         }
-
-        if (closedir(dir) == -1)
+        if (arg[0] == '-' && arg[1] != '\0' && arg[1] != '-')
         {
-            perror("smash error: closedir failed");
+            // -l counts hard links every time, -x stays on one file system
+            for (const char *flag = arg + 1; *flag; ++flag)
+            {
+                if (*flag == 'l')
+                {
+                    walker.count_links = true;
+                }
+                else if (*flag == 'x')
+                {
+                    walker.one_filesystem = true;
+                }
+                else
+                {
+                    cerr << "smash error: du: invalid arguments" << endl;
+                    return;
+                }
+            }
+            continue;
         }
+        dir = arg;
+        dir_args++;
     }
 
-    return total_size;
-}
-
-void DuCommand::execute()
-{
-
-    if (this->args_count > 2)
+    if (dir_args > 1)
     {
         cerr << "smash error: du: too many arguments" << endl;
+        return;
     }
 
-    string dir;
-
-    if (this->args_count == 1)
+    if (dir_args == 0)
     {
         // current dir
         char current_directory[COMMAND_MAX_LENGTH];
@@ -1326,19 +5111,38 @@ void DuCommand::execute()
         dir = current_directory;
     }
 
-    if (this->args_count == 2)
-    {
-        // specified dir
-        dir = this->args[1];
-    }
-
     if (access(dir.c_str(), F_OK) == -1)
     {
         cerr << "smash error: du: directory " << dir << " does not exist" << endl;
         return;
     }
 
-    double total = calculateDiskUsage(dir);
+    // Only --cache trusts earlier runs: a file rewritten in place does not
+    // touch its directory, so its old size would be reported. --rebuild walks
+    // everything but still leaves a fresh cache behind.
+    DuCache previous, updated;
+    std::string cache_path;
+    struct stat root_stat;
+    bool use_cache = cache && lstat(dir.c_str(), &root_stat) == 0 && S_ISDIR(root_stat.st_mode) &&
+                     _duCachePath(root_stat, cache_path);
+    if (use_cache && !rebuild)
+    {
+        previous.load(cache_path.c_str());
+    }
+    struct timespec started;
+    clock_gettime(CLOCK_REALTIME, &started);
+
+    double total = walker.walk(dir.c_str(), use_cache ? &previous : nullptr, use_cache ? &updated : nullptr);
+    if (use_cache)
+    {
+        // The cache only saves work, a read-only home must not break du
+        updated.save(cache_path.c_str(), started);
+    }
+    std::vector<std::pair<long, std::string>> heaviest = walker.heaviest();
+    for (size_t i = 0; i < heaviest.size(); ++i)
+    {
+        cout << heaviest[i].first << "\t" << heaviest[i].second << "\n";
+    }
     cout << "Total disk usage: " << total << " KB" << endl;
 }
 
@@ -1402,62 +5206,41 @@ void NetInfo::execute()
     // Get Default Gateway from /proc/net/route
     std::string gateway_str;
     {
-        int fd = open("/proc/net/route", O_RDONLY);
-        if (fd < 0)
+        LineReader reader("/proc/net/route");
+        const char *line;
+        size_t len;
+        if (!reader.isOpen())
         {
             perror("smash error: open failed");
             // Not having route info isn't fatal to the rest; we just won't print gateway.
         }
-        else
+        else if (reader.next(line, len)) // Skip the header line
         {
-            char line[BUF_SIZE];
-            // Skip the header line
-            if (readLine(fd, line, sizeof(line)) < 0)
-            {
-                // readLine already printed perror, just close and continue
-                close(fd);
-            }
-            else
+            while (reader.next(line, len))
             {
-                while (true)
+                // Parse the line
+                char iface[IFNAMSIZ];
+                char dest[32], gate[32];
+                if (sscanf(line, "%15s %31s %31s", iface, dest, gate) == 3)
                 {
-                    ssize_t rd = readLine(fd, line, sizeof(line));
-                    if (rd < 0)
-                    {
-                        // readLine printed error
-                        break;
-                    }
-                    if (rd == 0)
+                    if (ifname == iface && strcmp(dest, "00000000") == 0)
                     {
-                        // EOF
-                        break;
-                    }
-
-                    // Parse the line
-                    char iface[IFNAMSIZ];
-                    char dest[32], gate[32];
-                    if (sscanf(line, "%s %s %s", iface, dest, gate) == 3)
-                    {
-                        if (ifname == iface && strcmp(dest, "00000000") == 0)
+                        unsigned long g;
+                        if (sscanf(gate, "%lx", &g) == 1)
                         {
-                            unsigned long g;
-                            if (sscanf(gate, "%lx", &g) == 1)
+                            struct in_addr ga;
+                            ga.s_addr = g;
+                            char g_ip[INET_ADDRSTRLEN];
+                            if (!inet_ntop(AF_INET, &ga, g_ip, sizeof(g_ip)))
                             {
-                                struct in_addr ga;
-                                ga.s_addr = g;
-                                char g_ip[INET_ADDRSTRLEN];
-                                if (!inet_ntop(AF_INET, &ga, g_ip, sizeof(g_ip)))
-                                {
-                                    perror("smash error: inet_ntop failed");
-                                    break;
-                                }
-                                gateway_str = g_ip;
+                                perror("smash error: inet_ntop failed");
                                 break;
                             }
+                            gateway_str = g_ip;
+                            break;
                         }
                     }
                 }
-                close(fd);
             }
         }
     }
@@ -1465,29 +5248,19 @@ void NetInfo::execute()
     // Get DNS servers from /etc/resolv.conf
     std::string dns_list;
     {
-        int fd = open("/etc/resolv.conf", O_RDONLY);
-        if (fd < 0)
+        LineReader reader("/etc/resolv.conf");
+        if (!reader.isOpen())
         {
             // If resolv.conf can't be opened, no DNS info
             perror("smash error: open failed");
         }
         else
         {
-            char line[BUF_SIZE];
-            while (true)
+            const char *line;
+            size_t len;
+            while (reader.next(line, len))
             {
-                ssize_t n = readLine(fd, line, sizeof(line));
-                if (n < 0)
-                {
-                    // readLine printed error
-                    break;
-                }
-                if (n == 0)
-                {
-                    // EOF
-                    break;
-                }
-                char *p = line;
+                const char *p = line;
                 while (*p == ' ' || *p == '\t')
                     p++;
                 if (strncmp(p, "nameserver", 10) == 0)
@@ -1495,18 +5268,17 @@ void NetInfo::execute()
                     p += 10;
                     while (*p == ' ' || *p == '\t')
                         p++;
-                    if (*p != '\0' && *p != '\n')
+                    if (*p != '\0')
                     {
                         std::string dns_ip(p);
-                        // Remove trailing newline
-                        dns_ip.erase(dns_ip.find_last_not_of("\r\n") + 1);
+                        // Remove trailing whitespace
+                        dns_ip.erase(dns_ip.find_last_not_of(" \t\r") + 1);
                         if (!dns_list.empty())
                             dns_list += ", ";
                         dns_list += dns_ip;
                     }
                 }
             }
-            close(fd);
         }
     }
 
@@ -5,10 +5,24 @@
 #include <vector>
 #include <string>
 #include <list>
+#include <deque>
 #include <set>
 #include <map>
-#include <regex>
 #include <unordered_map>
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <glob.h>
+
+#include "signals.h"
 
 #define COMMAND_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
@@ -16,19 +30,60 @@
 
 using namespace std;
 
+// How smash launches external programs. posix_spawn and vfork do not copy
+// the shell's page tables, fork is kept as the fallback for children that
+// have to run smash code before exec.
+enum SpawnMode
+{
+    SPAWN_POSIX,
+    SPAWN_VFORK,
+    SPAWN_FORK
+};
+
+bool parseSpawnMode(const char *name, SpawnMode *mode);
+const char *spawnModeName(SpawnMode mode);
+
+// Starts argv in a new process group (like setpgrp in the child).
+// cgroup_fd is an open cgroup v2 directory to start the child in, which
+// always takes the fork path. stdout_fd and stdin_fd, if not -1, become the
+// child's stdout and stdin. Returns the child pid, or -1 after printing the
+// smash error.
+pid_t spawnProcess(const char *path, char *const argv[], bool search_path, SpawnMode mode, int cgroup_fd = -1,
+                   int stdout_fd = -1, int stdin_fd = -1);
+
+// Splits cmd_line into args in a single pass, writing the tokens into arena
+// (which must hold strlen(cmd_line) + 1 bytes). Quotes group words and are
+// dropped; quoted[i] tells if any part of args[i] was quoted.
+// args and quoted hold max_args slots, the last one for the NULL.
+// Does not allocate. Returns the number of args, or -1 if there are more
+// words than fit.
+int _parseCommandLine(const char *cmd_line, char **args, char *arena, bool *quoted, int max_args);
+
 class Command
 {
     // TODO: Add your data members
+    char inline_arena[BUF_SIZE]; // token storage for args, enough for any typed line
+    char *heap_arena;            // only for lines that do not fit
+    char *inline_args[COMMAND_MAX_ARGS];
+    bool inline_quoted[COMMAND_MAX_ARGS];
+    char **heap_args; // only for lines with more words than that
+    bool *heap_quoted;
 
 public:
     const char *cmd_line;
-    char *args[COMMAND_MAX_ARGS];
+    char **args;
+    bool *quoted;
     int args_count;
-    Command(const char *cmd_line) : cmd_line(cmd_line), args{}, args_count(0)
+    Command(const char *cmd_line)
+        : heap_arena(nullptr), inline_args{}, inline_quoted{}, heap_args(nullptr), heap_quoted(nullptr),
+          cmd_line(cmd_line), args(inline_args), quoted(inline_quoted), args_count(0)
     {
         this->prepare();
     };
 
+    Command(Command const &) = delete;
+    void operator=(Command const &) = delete;
+
     virtual ~Command()
     {
         this->cleanup();
@@ -57,11 +112,25 @@ public:
     string command;
     bool is_background_command = false;
     string original_cmd;
+    int cgroup_fd = -1; // set by limit, see spawnProcess
+    string cgroup;      // path of that cgroup, handed to the job
     ExternalCommand(const char *cmd_line, string &command, bool is_background_command, string &original_cmd);
 
     virtual ~ExternalCommand() {}
 
     void execute() override;
+
+    // Starts the command without waiting for it or adding a job, with
+    // stdout_fd and stdin_fd as its stdout and stdin if given. Returns -1 if
+    // it could not start.
+    pid_t spawn(int stdout_fd = -1, int stdin_fd = -1);
+
+    // Replaces the calling process with the command, used by forked children. Never returns.
+    void execInPlace();
+
+private:
+    // Builds the final argv and resolves the program path. Returns nullptr if it was not found.
+    const char *prepareExec(vector<char *> &argv, glob_t *globbuf);
 };
 
 class RedirectionCommand : public Command
@@ -79,11 +148,11 @@ public:
 class PipeCommand : public Command
 {
 public:
-    string cmd1;
-    string cmd2;
-    bool is_stderr;
+    vector<string> stages;
+    vector<bool> stderr_pipes; // stage i writes stderr (|&) instead of stdout into pipe i
+    bool is_background_command;
 
-    PipeCommand(const std::string &cmd_line, const std::string &part1, const std::string &part2, bool is_stderr);
+    PipeCommand(const char *cmd_line, const vector<string> &stages, const vector<bool> &stderr_pipes, bool is_background_command);
     virtual ~PipeCommand() {}
     void execute() override;
 };
@@ -156,6 +225,160 @@ public:
     void execute() override;
 };
 
+struct DuNode;
+struct DuWorker;
+struct DuListing;
+
+struct DuCacheKey
+{
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const DuCacheKey &other) const { return this->dev == other.dev && this->ino == other.ino; }
+};
+
+struct DuCacheKeyHash
+{
+    size_t operator()(const DuCacheKey &key) const { return std::hash<ino_t>()(key.ino) * 31 + key.dev; }
+};
+
+// What du needs to skip listing a directory: the KB of its plain files, the
+// names of its subdirectories ('\0'-terminated, back to back) and the files
+// that need the hard link / mount check again (packed DuCacheLink records)
+struct DuCacheEntry
+{
+    struct timespec mtime;
+    struct timespec ctime;
+    long files_kb;
+    std::string subdirs;
+    std::string links;
+};
+
+struct DuCacheLink
+{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t kb;
+};
+
+#define INODE_SET_SHARDS (64)
+
+// Concurrent set of (dev, ino) pairs, so du counts a hard-linked file once.
+// Linear probing over 16-byte slots, split in shards with a lock each.
+class InodeSet
+{
+public:
+    InodeSet();
+
+    InodeSet(InodeSet const &) = delete;
+    void operator=(InodeSet const &) = delete;
+
+    ~InodeSet();
+
+    // True if the pair was not in the set yet
+    bool insert(dev_t dev, ino_t ino);
+    void clear();
+    size_t size();
+
+private:
+    struct Slot
+    {
+        uint64_t dev;
+        uint64_t ino; // 0 marks a free slot, no inode has number 0
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        Slot *slots;
+        size_t mask;
+        size_t used;
+    };
+
+    Shard shards[INODE_SET_SHARDS];
+
+    static void grow(Shard &shard);
+};
+
+// Per-directory subtotals from earlier du runs, one cache file per walk root.
+// A directory whose mtime and ctime did not move is not listed again; its
+// subdirectories are still visited since their changes do not reach it.
+// Files rewritten in place do not move their directory either, which is why
+// du only uses it under --cache.
+class DuCache
+{
+public:
+    std::unordered_map<DuCacheKey, DuCacheEntry, DuCacheKeyHash> entries;
+
+    // The entry for a directory, if it is still current
+    const DuCacheEntry *lookup(const struct stat &dir_stat) const;
+
+    // A missing or foreign file just leaves the cache empty
+    void load(const char *path);
+
+    // Entries changed less than a second before since are left out, their
+    // directory could change again within the same timestamp tick
+    bool save(const char *path, const struct timespec &since) const;
+};
+
+// Parallel walker behind du: a work-stealing pool over directories. Each
+// directory is listed with getdents64 and its entries are stat'ed relative
+// to the directory fd, so no full paths are ever built.
+class DiskUsageWalker
+{
+public:
+    // threads <= 0 means one per online CPU
+    explicit DiskUsageWalker(int threads = 0);
+
+    bool count_links = false;    // du -l: count every hard link of a file
+    bool one_filesystem = false; // du -x: stay on the st_dev of the root
+    bool stream = false;         // du --stream: print each directory as its subtree completes
+    size_t top = 0;              // du --top N: remember the N largest directories
+    bool use_uring = true;       // batch the per-file stats through io_uring when the kernel can
+
+    // Whether the last walk actually ran on io_uring
+    bool usedUring() const { return this->uring_used; }
+
+    // The --top directories, largest first
+    std::vector<std::pair<long, std::string>> heaviest();
+
+    DiskUsageWalker(DiskUsageWalker const &) = delete;
+    void operator=(DiskUsageWalker const &) = delete;
+
+    // Size in KB of path and everything below it. Directories found current
+    // in previous are not listed; every directory seen is recorded in updated.
+    long walk(const char *path, const DuCache *previous = nullptr, DuCache *updated = nullptr);
+
+private:
+    int thread_count;
+    std::vector<DuWorker *> workers;
+    std::atomic<long> queued;
+    std::atomic<int> sleepers;
+    std::atomic<bool> done;
+    std::mutex idle_lock;
+    std::condition_variable idle_cond;
+    const DuCache *previous;
+    bool recording;
+    dev_t root_dev;
+    bool uring_used = false;
+    InodeSet inodes;
+    std::mutex report_lock;
+    std::vector<std::pair<long, std::string>> top_heap; // min-heap of at most top entries
+    std::chrono::steady_clock::time_point last_flush;
+
+    void push(DuWorker *self, DuNode *node);
+    DuNode *take(DuWorker *self);
+    void work(DuWorker *self);
+    void process(DuWorker *self, DuNode *node);
+    void finish(DuNode *node);
+    // KB to add for a file that could be reached twice (-l and -x aware)
+    long linkedKb(uint64_t dev, uint64_t ino, long kb);
+    void report(DuNode *node, long kb);
+    void addSubdir(DuWorker *self, DuNode *node, DuListing &listing, const char *name);
+    void addEntry(DuWorker *self, DuNode *node, DuListing &listing, const char *name, const struct stat &entry_stat);
+    void statBatch(DuWorker *self, DuNode *node, DuListing &listing, unsigned count);
+};
+
 class DuCommand : public Command
 {
     // TODO: Add your data members public:
@@ -169,6 +392,22 @@ public:
     void execute() override;
 };
 
+// Fields of a /proc/<pid>/stat line, comm points into the scanned buffer
+struct ProcStat
+{
+    const char *comm;
+    size_t comm_len;
+    char state;
+    long utime;
+    long stime;
+    long ticks; // utime + stime
+    unsigned long long start_ticks;
+    long rss_pages;
+};
+
+// Picks the fields above out of a stat line in one pass, without copying
+bool _scanProcStat(const char *line, ProcStat *stat);
+
 class WatchProcCommand : public BuiltInCommand
 {
 public:
@@ -179,6 +418,11 @@ public:
     }
 
     void execute() override;
+
+private:
+    // watchproc -i/-n: count samples (0 = until Ctrl-C) of the CPU used over
+    // each interval, re-reading fds that stay open
+    void sample(pid_t pid, long interval_ms, long count);
 };
 
 class GetCurrDirCommand : public BuiltInCommand
@@ -222,46 +466,273 @@ public:
     void execute() override;
 };
 
+// Resources used by finished children, summed from wait4's rusage
+struct JobUsage
+{
+    double real_seconds;
+    double user_seconds;
+    double sys_seconds;
+    long max_rss_kb; // the largest child, not a sum
+    long voluntary_switches;
+    long involuntary_switches;
+
+    JobUsage() : real_seconds(0), user_seconds(0), sys_seconds(0), max_rss_kb(0), voluntary_switches(0),
+                 involuntary_switches(0) {}
+
+    void add(const struct rusage &usage);
+    void add(const JobUsage &other);
+};
+
+// "real 1.002s  user 0.500s  sys 0.010s  maxrss 1234 KB  ctxsw 10/2"
+std::ostream &operator<<(std::ostream &out, const JobUsage &usage);
+
+#define JOBS_HISTORY_SIZE (32)
+
+// Jobs live in a flat slab. A pid hash and a job-id table point into it, and
+// two intrusive lists keep all jobs and the stopped jobs in job-id order, so
+// every lookup, the last-job queries and reaping are O(1). Stopping a job
+// walks back from the stopped tail to its place, which is O(1) only when
+// jobs stop in the order they were started.
+// JobEntry pointers stay valid only until the next addJob or erase, and
+// Ctrl-C erases the foreground job, so do not keep one across a wait.
 class JobsList
 {
 public:
     class JobEntry
     {
-        // TODO: Add your data members
     public:
         int job_id;
         bool stopped;
         pid_t pid;
         string command;
-        JobEntry(int jobId, pid_t pid, const string &cmd, bool _stopped) : job_id(jobId), pid(pid), command(cmd),
-                                                                           stopped(_stopped) {}
+        int pidfd; // watched by the event loop, -1 if pidfds are not available
+        struct timespec started; // CLOCK_MONOTONIC when the job was added
+        string cgroup;           // cgroup v2 directory made by limit, removed with the job
+        bool queued;             // started by jobq, holds one of its slots
+
+        // A pipeline job is every stage in the process group pid leads. The
+        // job ends with the last of them and reports the last stage's status.
+        bool pipeline;
+        std::vector<pid_t> members; // not reaped yet, pid stays in pid_index until the job ends
+        pid_t last_stage;
+        int status;     // of last_stage once it ended
+        JobUsage usage; // of the members reaped so far
+
+        // intrusive links, slab slots or -1
+        int prev;
+        int next;
+        int prev_stopped;
+        int next_stopped;
+
+        JobEntry(int jobId, pid_t pid, const string &cmd, bool _stopped) : job_id(jobId), stopped(_stopped), pid(pid), command(cmd),
+                                                                           pidfd(-1), started(), queued(false), pipeline(false), members(1, pid), last_stage(pid), status(0),
+                                                                           prev(-1), next(-1), prev_stopped(-1), next_stopped(-1) {}
+
+        // The whole process group for a pipeline, the one process otherwise
+        int sendSignal(int signum) const
+        {
+            return kill(this->pipeline ? -this->pid : this->pid, signum);
+        }
+    };
+
+    // A job that ended, kept for jobs -l
+    struct FinishedJob
+    {
+        int job_id;
+        string command;
+        int status;
+        JobUsage usage;
     };
-    std::map<int, JobEntry> jobs;
-    int next;
 
-    // TODO: Add your data members
+    // A child wait4(-1) reaped before it was added as a job
+    struct UnclaimedChild
+    {
+        pid_t pid;
+        int status;
+        struct rusage usage;
+    };
+
+    // A jobq command waiting for a slot
+    struct QueuedCommand
+    {
+        int priority;
+        unsigned long order;
+        string cmd_line;
+    };
+
+private:
+    std::vector<JobEntry> slots;
+    std::vector<int> free_slots;
+    std::unordered_map<pid_t, int> pid_index; // pid -> slot
+    std::vector<int> id_index;                // job id -> slot or -1
+    int head;                                 // lowest job id
+    int tail;                                 // highest job id
+    int stopped_head;
+    int stopped_tail;
+    size_t count;
+    std::deque<FinishedJob> finished; // the last JOBS_HISTORY_SIZE jobs that ended
+    std::vector<UnclaimedChild> unclaimed; // cleared by every addJob
+
+    // jobq: a heap on priority, then arrival order
+    std::vector<QueuedCommand> queue;
+    unsigned long queue_order;
+    int queue_limit;          // most jobq jobs running at once
+    int queue_running;        // live jobs with queued set
+    unsigned long jobs_added; // tells startQueued whether a command became a job
+
+    int slotOf(int jobId) const;
+    void unlinkStopped(int slot);
+    void eraseSlot(int slot);
+    void memberEnded(int slot, pid_t pid, int status, const struct rusage &usage);
+
 public:
     JobsList();
 
     ~JobsList() = default;
 
-    void addJob(Command *cmd, pid_t pid, bool stopped = false);
+    void addJob(Command *cmd, pid_t pid, bool stopped = false, const string &cgroup = string());
+
+    // A pipeline: pids are its stages in order, the first leads the process group
+    void addJob(Command *cmd, const std::vector<pid_t> &pids, bool stopped = false, const string &cgroup = string());
+
+    // Accounts for one process of a job that was reaped outside the jobs list,
+    // erasing the job with the last of them
+    void childEnded(pid_t pid, int status, const struct rusage &usage);
+
+    // verbose (jobs -l) adds state and resource usage, and the jobs that already ended
+    void printJobsList(bool verbose = false);
 
-    void printJobsList();
+    // Keeps what wait4 reported for a job that ended, call it before erasing the job
+    void recordFinished(const JobEntry &job, int status, const struct rusage &usage);
 
     void killAllJobs();
 
+    // Before smash exits: removes the limit cgroups of jobs that ended and
+    // names the ones a running job still holds
+    void releaseCgroups();
+
     void removeFinishedJobs();
 
     JobEntry *getJobById(int jobId);
 
+    JobEntry *getJobByPid(pid_t pid);
+
     void removeJobById(int jobId);
 
+    void removeJobByPid(pid_t pid);
+
+    // Keeps the stopped-jobs list in sync, always use this instead of writing job->stopped
+    void setStopped(JobEntry *job, bool stopped);
+
+    // Called by the event loop when the pidfd of a job becomes readable
+    void reapJob(pid_t pid);
+
     JobEntry *getLastJob(int *lastJobId);
 
     JobEntry *getLastStoppedJob(int *jobId);
 
-    // TODO: Add extra methods or modify exisitng ones as needed
+    // Jobs in job-id order: for (job = firstJob(); job; job = nextJob(job))
+    JobEntry *firstJob();
+
+    JobEntry *nextJob(const JobEntry *job);
+
+    // jobq: runs cmd_line in the background once fewer than queueLimit() of
+    // the jobs it started are running. Higher priorities go first.
+    void enqueue(const string &cmd_line, int priority);
+
+    // Starts queued commands while there are free slots. Only the main loop and
+    // jobq call it, never addJob or the reaping path, since it runs commands.
+    void startQueued();
+
+    // Blocks until nothing is queued and, with until_done, the queued jobs
+    // have ended too. Returns false on Ctrl-C.
+    bool waitQueue(bool until_done);
+
+    // "limit 4, 4 running, 120 queued" and the queued commands in start order
+    void printQueue();
+
+    // Commands still waiting for a jobq slot
+    bool queueWaiting() const
+    {
+        return !this->queue.empty();
+    }
+
+    int queueLimit() const
+    {
+        return this->queue_limit;
+    }
+
+    void setQueueLimit(int limit);
+
+    size_t size() const
+    {
+        return this->count;
+    }
+};
+
+// procmon [-s cpu|rss] [-i ms] [-n count] [pid ...]: CPU and memory of all
+// jobs (or the given pids) in one table, sampled with fds kept open
+class ProcMonCommand : public BuiltInCommand
+{
+public:
+    ProcMonCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+
+    virtual ~ProcMonCommand() {}
+
+    void execute() override;
+};
+
+// time <command>: runs the command and prints its resource usage to stderr
+class TimeCommand : public BuiltInCommand
+{
+public:
+    TimeCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+
+    virtual ~TimeCommand() {}
+
+    void execute() override;
+};
+
+// limit [cpu=N%] [mem=SIZE] [io=MAJ:MIN:BPS] command [&]: runs an external
+// command in a cgroup v2 of its own under $SMASH_CGROUP_ROOT, which has to
+// be a subtree delegated to the user. jobs shows its pressure stall stats.
+class LimitCommand : public BuiltInCommand
+{
+public:
+    LimitCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+
+    virtual ~LimitCommand() {}
+
+    void execute() override;
+};
+
+// parallel [-j N] template [::: item ...]: runs the template once per item
+// (every {} replaced by it, or it added as the last word), at most N at a
+// time. Items come from stdin, one per line, when there is no :::. Each
+// command's stdout is buffered and printed in input order.
+class ParallelCommand : public BuiltInCommand
+{
+public:
+    ParallelCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+
+    virtual ~ParallelCommand() {}
+
+    void execute() override;
+};
+
+// jobq [-j N] [-p PRIO] [-w] [command]: queues a background command behind
+// at most N running jobq jobs (the number of CPUs by default), -w waits
+// until the queue has drained and its jobs ended, no command lists the queue
+class JobQueueCommand : public BuiltInCommand
+{
+    JobsList *jobs;
+
+public:
+    JobQueueCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+
+    virtual ~JobQueueCommand() {}
+
+    void execute() override;
 };
 
 class JobsCommand : public BuiltInCommand
@@ -333,6 +804,53 @@ public:
     void execute() override;
 };
 
+// Aliases in the order they were defined, with an open-addressing index on top.
+// Lookups hash the name in place, so expanding an alias does not allocate.
+// Removed entries stay as tombstones until they outnumber the live ones.
+class AliasStore
+{
+public:
+    class AliasEntry
+    {
+    public:
+        string name;
+        string value;
+        bool alive;
+        AliasEntry(const string &name, const string &value) : name(name), value(value), alive(true) {}
+    };
+
+    AliasStore();
+
+    // Parses a whole "alias name='command'" line, returns false if it is malformed
+    static bool parseDefinition(const char *line, size_t length, string &name, string &value);
+
+    // Returns false if name already exists
+    bool add(const string &name, const string &value);
+
+    // Returns false if name does not exist
+    bool remove(const char *name);
+
+    // Returns the command of the alias, or nullptr
+    const string *find(const char *name, size_t length) const;
+
+    void reserve(size_t count);
+
+    const vector<AliasEntry> &entries() const
+    {
+        return this->list;
+    }
+
+private:
+    vector<AliasEntry> list;
+    vector<int> index; // slots into list, EMPTY or TOMBSTONE
+    size_t live;
+    size_t used_slots; // live + tombstone slots
+
+    static size_t hash(const char *name, size_t length);
+    int findSlot(const char *name, size_t length) const;
+    void rebuild(size_t capacity);
+};
+
 class UnSetEnvCommand : public BuiltInCommand
 {
 public:
@@ -348,6 +866,128 @@ public:
     void execute() override;
 };
 
+class HashCommand : public BuiltInCommand
+{
+public:
+    HashCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+
+    virtual ~HashCommand()
+    {
+    }
+
+    void execute() override;
+};
+
+class PipeSizeCommand : public BuiltInCommand
+{
+public:
+    PipeSizeCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+
+    virtual ~PipeSizeCommand()
+    {
+    }
+
+    void execute() override;
+};
+
+// Remembers where in $PATH each external command was found, like bash's hash table,
+// so a launch costs one execve instead of trying every PATH directory.
+class CommandHash
+{
+public:
+    class HashEntry
+    {
+    public:
+        string path;
+        int hits;
+        HashEntry(const string &path) : path(path), hits(0) {}
+    };
+
+    // Returns the path of name, or nullptr if it is not in PATH.
+    // Names containing a '/' are returned as is. Hits in relative PATH
+    // entries (like "." or "bin") are looked up again every time.
+    const char *lookup(const char *name);
+
+    // Resolves name without counting a hit. Returns false if it is not in PATH.
+    bool add(const char *name);
+
+    void clear();
+
+    void print();
+
+private:
+    string path_value; // PATH the table was built for
+    unordered_map<string, HashEntry> table;
+    HashEntry uncached{""}; // the last hit in a relative PATH entry, never in table
+
+    void checkPathChanged();
+    HashEntry *find(const char *name);
+};
+
+// A whole file mapped read-only into memory
+class MappedFile
+{
+public:
+    const char *data;
+    size_t size;
+
+    MappedFile() : data(nullptr), size(0) {}
+
+    MappedFile(MappedFile const &) = delete;
+    void operator=(MappedFile const &) = delete;
+
+    ~MappedFile();
+
+    // Returns false (errno set) if the file cannot be opened or mapped
+    bool open(const char *path);
+};
+
+#define LINE_READER_SIZE (16 * 1024)
+
+// Buffered reader for /proc and /etc files. Lines are handed out as views
+// into the reader's buffer (delimiter replaced by '\0'), valid until the
+// next call. Lines longer than the buffer grow it.
+class LineReader
+{
+public:
+    explicit LineReader(const char *path, char delim = '\n');
+
+    LineReader(LineReader const &) = delete;
+    void operator=(LineReader const &) = delete;
+
+    ~LineReader();
+
+    bool isOpen() const { return this->fd != -1; }
+    bool failed() const { return this->error; }
+
+    // Returns false at EOF or on a read error
+    bool next(const char *&line, size_t &len);
+
+private:
+    int fd;
+    char delim;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    bool eof;
+    bool error;
+};
+
+class SmallShell;
+
+// Builtin registry, a static table sorted by name (see Commands.cpp)
+struct BuiltinEntry
+{
+    const char *name;
+    Command *(*factory)(const char *cmd_line, SmallShell &smash);
+    bool whole_line; // gets the line before pipes, redirection and & are split off, like time
+    bool starts_job; // with & it runs its command as a background job, so jobq can queue it
+};
+
+// Returns nullptr if name is not a builtin
+const BuiltinEntry *findBuiltin(const char *name);
+
 class SmallShell
 {
 private:
@@ -356,18 +996,26 @@ private:
     std::string prompt;
     char *plastPwd;
 
-    SmallShell() : prompt("smash"), plastPwd(nullptr), fg_pid(-1)
+    SmallShell() : prompt("smash"), plastPwd(nullptr), fg_pid(-1), spawn_mode(SPAWN_POSIX), pipe_size(0), last_status(0)
     {
+        const char *mode = getenv("SMASH_SPAWN_MODE");
+        if (mode && !parseSpawnMode(mode, &this->spawn_mode))
+        {
+            cerr << "smash error: unknown SMASH_SPAWN_MODE " << mode << endl;
+        }
     }
 
 public:
     pid_t fg_pid;
     JobsList jobs;
+    EventLoop events;
+    SpawnMode spawn_mode;
+    CommandHash command_hash;
+    int pipe_size; // F_SETPIPE_SZ for pipeline pipes, 0 keeps the kernel default
+    int last_status; // exit status of the last command, what smash exits with at EOF
+    JobUsage foreground_usage; // summed over the foreground children reaped, read by time
 
-    set<string> reserved = {"chprompt", "quit", "showpid", "watchproc", "unsetenv", "pwd", "cd", "jobs", "fg", "unalias", "alias", "kill", "listdir", "whoami", "netinfo"};
-
-    unordered_map<string, string> aliases;
-    std::list<std::pair<std::string, std::string>> alias_list;
+    AliasStore aliases;
 
     Command *CreateCommand(const char *cmd_line);
 
@@ -414,10 +1062,19 @@ public:
 
     void executeCommand(const char *cmd_line);
 
-    list<std::pair<std::string, std::string>> &getAliases();
-    unordered_map<string, string> &getAliasesMap();
+    AliasStore &getAliases();
 
     bool isReservedCommand(const string &command) const;
+
+    // Records a waitpid() status as last_status (128 + signal for killed commands)
+    void setWaitStatus(int status);
+
+    // Runs every line of a script, without prompts
+    void runScript(const char *data, size_t size);
+
+    // Loads aliases, prompt and environment from an rc file in one pass.
+    // Returns false if the file could not be opened.
+    bool loadRcFile(const char *path);
 };
 
 #endif // SMASH_COMMAND_H_
@@ -0,0 +1,59 @@
+// Builtin dispatch over a mixed command stream: the sorted builtin table
+// against the if-chain CreateCommand used to walk.
+// usage: dispatch_bench [lookups]
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../Commands.h"
+
+static const char *words[] = {
+    "ls", "jobs", "grep", "cd", "sleep", "kill", "watchproc", "cat",
+    "fg", "alias", "whoami", "echo", "du", "chprompt", "unsetenv", "make",
+};
+static const int word_count = sizeof(words) / sizeof(words[0]);
+
+// the old dispatch, in its original order
+static int chainLookup(const std::string &firstWord)
+{
+    static const char *chain[] = {"alias", "jobs", "fg", "quit", "kill", "chprompt", "showpid", "unalias",
+                                  "unsetenv", "du", "pwd", "cd", "watchproc", "whoami", "netinfo"};
+    for (int i = 0; i < (int)(sizeof(chain) / sizeof(chain[0])); ++i)
+    {
+        if (firstWord.compare(chain[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int lookups = argc > 1 ? atoi(argv[1]) : 5000000;
+    std::string stream[word_count];
+    for (int i = 0; i < word_count; ++i)
+    {
+        stream[i] = words[i];
+    }
+
+    long hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; ++i)
+    {
+        hits += chainLookup(stream[i % word_count]) != -1;
+    }
+    std::chrono::duration<double, std::nano> chain_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; ++i)
+    {
+        hits += findBuiltin(stream[i % word_count].c_str()) != nullptr;
+    }
+    std::chrono::duration<double, std::nano> table_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << "lookups: " << lookups << " (" << hits << " builtin hits)" << std::endl;
+    std::cout << "if-chain: " << chain_time.count() / lookups << " ns/lookup" << std::endl;
+    std::cout << "table:    " << table_time.count() / lookups << " ns/lookup" << std::endl;
+    return 0;
+}
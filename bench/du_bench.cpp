@@ -0,0 +1,139 @@
+// du over a generated tree: the old recursive lstat/readdir walk with full
+// path strings against DiskUsageWalker at increasing thread counts, with
+// the synchronous and the io_uring backend.
+// usage: du_bench [fanout] [depth] [files per dir] [max threads]
+// The tree is created under /tmp and removed at the end. Runs after the
+// first are served from the dentry cache, so this measures the syscall and
+// CPU side of the walk, not the device.
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../Commands.h"
+
+static long files_created = 0;
+static long dirs_created = 0;
+
+static void makeTree(const std::string &dir, int fanout, int depth, int files)
+{
+    for (int i = 0; i < files; ++i)
+    {
+        int fd = open((dir + "/f" + std::to_string(i)).c_str(), O_CREAT | O_WRONLY, 0644);
+        if (fd != -1)
+        {
+            // one block each so the totals are not all zero
+            if (write(fd, "x", 1) == 1)
+            {
+                files_created++;
+            }
+            close(fd);
+        }
+    }
+    if (depth == 0)
+    {
+        return;
+    }
+    for (int i = 0; i < fanout; ++i)
+    {
+        std::string sub = dir + "/d" + std::to_string(i);
+        if (mkdir(sub.c_str(), 0755) == 0)
+        {
+            dirs_created++;
+            makeTree(sub, fanout, depth - 1, files);
+        }
+    }
+}
+
+// The walk du used before the parallel walker
+static long serialUsage(const std::string &path)
+{
+    struct stat stat_buf;
+    if (lstat(path.c_str(), &stat_buf) == -1)
+    {
+        return 0;
+    }
+    long total = stat_buf.st_blocks / 2;
+    if (S_ISDIR(stat_buf.st_mode))
+    {
+        DIR *dir = opendir(path.c_str());
+        if (!dir)
+        {
+            return total;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+            total += serialUsage(path + "/" + name);
+        }
+        closedir(dir);
+    }
+    return total;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    int fanout = argc > 1 ? atoi(argv[1]) : 8;
+    int depth = argc > 2 ? atoi(argv[2]) : 4;
+    int files = argc > 3 ? atoi(argv[3]) : 20;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 4 ? atoi(argv[4]) : (int)(cpus > 0 ? cpus : 1);
+
+    char dir[] = "/tmp/smash_du_benchXXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("du_bench: temp dir");
+        return 1;
+    }
+    makeTree(dir, fanout, depth, files);
+    std::cout << "tree: " << dirs_created << " dirs, " << files_created << " files" << std::endl;
+
+    // warm the dentry and inode caches
+    long expected = serialUsage(dir);
+
+    auto start = std::chrono::steady_clock::now();
+    long total = serialUsage(dir);
+    std::cout << "serial lstat walk: " << msSince(start) << " ms (" << total << " KB)" << std::endl;
+
+    for (int uring = 0; uring <= 1; ++uring)
+    {
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            DiskUsageWalker walker(threads);
+            walker.use_uring = uring;
+            start = std::chrono::steady_clock::now();
+            total = walker.walk(dir);
+            if (uring && !walker.usedUring())
+            {
+                std::cout << "io_uring walker: not available here" << std::endl;
+                break;
+            }
+            std::cout << (uring ? "io_uring walker, " : "sync walker, ") << threads << " threads: "
+                      << msSince(start) << " ms (" << total << " KB)" << (total == expected ? "" : " MISMATCH")
+                      << std::endl;
+        }
+    }
+
+    nftw(dir, removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Wildcard command launches: smash's in-process glob against the old
+// "/bin/bash -c" round trip.
+// usage: glob_bench [launches] [files]
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../Commands.h"
+
+int main(int argc, char *argv[])
+{
+    int launches = argc > 1 ? atoi(argv[1]) : 500;
+    int files = argc > 2 ? atoi(argv[2]) : 100;
+
+    char dir[] = "/tmp/smash_glob_benchXXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) == -1)
+    {
+        perror("glob_bench: temp dir");
+        return 1;
+    }
+    for (int i = 0; i < files; ++i)
+    {
+        close(open(("file" + std::to_string(i) + ".log").c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+
+    // keep ls output out of the report
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+
+    SmallShell &smash = SmallShell::getInstance();
+    char *bash_args[] = {(char *)"/bin/bash", (char *)"-c", (char *)"ls *.log", nullptr};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < launches; ++i)
+    {
+        pid_t pid = spawnProcess("/bin/bash", bash_args, false, smash.spawn_mode);
+        waitpid(pid, nullptr, 0);
+    }
+    std::chrono::duration<double> bash_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < launches; ++i)
+    {
+        smash.executeCommand("ls *.log");
+    }
+    std::chrono::duration<double> native_time = std::chrono::steady_clock::now() - start;
+
+    dup2(report_fd, STDOUT_FILENO);
+    std::cout << "launches: " << launches << ", files: " << files << std::endl;
+    std::cout << "bash -c: " << (long)(launches / bash_time.count()) << " launches/s" << std::endl;
+    std::cout << "native:  " << (long)(launches / native_time.count()) << " launches/s" << std::endl;
+
+    for (int i = 0; i < files; ++i)
+    {
+        unlink(("file" + std::to_string(i) + ".log").c_str());
+    }
+    rmdir(dir);
+    return 0;
+}
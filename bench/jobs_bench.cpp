@@ -0,0 +1,77 @@
+// Jobs table operations with a large number of synthetic jobs.
+// usage: jobs_bench [jobs]
+// The pids are made up, nothing is forked; the reaper is never triggered
+// because no SIGCHLD arrives.
+#include <chrono>
+#include <iostream>
+
+#include "../Commands.h"
+
+class SyntheticCommand : public Command
+{
+public:
+    SyntheticCommand(const char *cmd_line) : Command(cmd_line) {}
+    void execute() override {}
+};
+
+static double nsPerOp(std::chrono::steady_clock::time_point start, int ops)
+{
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ops;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+    const pid_t first_pid = 1000000;
+    JobsList &jobs = SmallShell::getInstance().jobs;
+    SyntheticCommand cmd("sleep 100");
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        jobs.addJob(&cmd, first_pid + i, false);
+    }
+    std::cout << "jobs: " << jobs.size() << std::endl;
+    std::cout << "addJob:            " << nsPerOp(start, count) << " ns" << std::endl;
+
+    long checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        checksum += jobs.getJobById(i + 1)->pid;
+    }
+    std::cout << "getJobById:        " << nsPerOp(start, count) << " ns" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        checksum += jobs.getJobByPid(first_pid + i)->job_id;
+    }
+    std::cout << "getJobByPid:       " << nsPerOp(start, count) << " ns" << std::endl;
+
+    // stop every other job, as a reaper would on SIGCHLD
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i += 2)
+    {
+        jobs.setStopped(jobs.getJobById(i + 1), true);
+    }
+    std::cout << "setStopped:        " << nsPerOp(start, count / 2) << " ns" << std::endl;
+
+    int job_id;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        checksum += jobs.getLastJob(&job_id)->pid + jobs.getLastStoppedJob(&job_id)->pid;
+    }
+    std::cout << "last/last stopped: " << nsPerOp(start, count) << " ns" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        jobs.removeJobByPid(first_pid + i);
+    }
+    std::cout << "removeJobByPid:    " << nsPerOp(start, count) << " ns" << std::endl;
+    std::cout << "jobs left: " << jobs.size() << " (checksum " << checksum << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,65 @@
+// parallel over many short commands against the same fan-out through a
+// pipe into xargs -P, which is what scripts did before the builtin.
+// usage: parallel_bench [items] [jobs]
+// Both run /bin/true once per item. Output is discarded, only the launch
+// and reap rate is measured.
+#include <unistd.h>
+#include <fcntl.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../Commands.h"
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    int items = argc > 1 ? atoi(argv[1]) : 2000;
+    int jobs = argc > 2 ? atoi(argv[2]) : 4;
+    std::string count = std::to_string(items);
+    std::string limit = std::to_string(jobs);
+    std::cout << "items: " << items << ", jobs: " << jobs << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string pipeline = "seq " + count + " | xargs -P " + limit + " -n 1 /bin/true";
+    if (system(pipeline.c_str()) != 0)
+    {
+        std::cout << "xargs failed" << std::endl;
+    }
+    std::cout << "seq | xargs -P: " << msSince(start) << " ms" << std::endl;
+
+    // the builtin reads its items from stdin, hand it the same list
+    char path[] = "/tmp/smash_parallel_benchXXXXXX";
+    int items_fd = mkstemp(path);
+    if (items_fd == -1)
+    {
+        perror("parallel_bench: temp file");
+        return 1;
+    }
+    unlink(path);
+    for (int i = 1; i <= items; ++i)
+    {
+        std::string line = std::to_string(i) + "\n";
+        if (write(items_fd, line.data(), line.size()) != (ssize_t)line.size())
+        {
+            perror("parallel_bench: write");
+            return 1;
+        }
+    }
+    lseek(items_fd, 0, SEEK_SET);
+    dup2(items_fd, STDIN_FILENO);
+    close(items_fd);
+
+    std::string line = "parallel -j " + limit + " /bin/true";
+    ParallelCommand parallel(line.c_str());
+    start = std::chrono::steady_clock::now();
+    parallel.execute();
+    std::cout << "parallel:       " << msSince(start) << " ms (" << SmallShell::getInstance().last_status
+              << " failed)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,69 @@
+// Command line tokenizer throughput: the arena tokenizer against the
+// previous istringstream + malloc per token version.
+// usage: parse_bench [iterations]
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+#include "../Commands.h"
+
+static const char *lines[] = {
+    "ls -la /tmp",
+    "sleep 100 &",
+    "chprompt hello",
+    "grep -n \"some pattern\" file1.txt file2.txt file3.txt",
+    "alias ll='ls -l --color=auto'",
+    "kill -9 3",
+    "du /var/log",
+    "echo a b c d e f g h i j k l m n o p",
+};
+static const int line_count = sizeof(lines) / sizeof(lines[0]);
+
+// the tokenizer smash used before, kept here as the baseline
+static int streamParse(const char *cmd_line, char **args)
+{
+    int i = 0;
+    std::istringstream iss(cmd_line);
+    for (std::string s; iss >> s;)
+    {
+        args[i] = (char *)malloc(s.length() + 1);
+        memset(args[i], 0, s.length() + 1);
+        strcpy(args[i], s.c_str());
+        args[++i] = NULL;
+    }
+    return i;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    char *args[COMMAND_MAX_ARGS];
+    bool quoted[COMMAND_MAX_ARGS];
+    char arena[BUF_SIZE];
+    long tokens = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        int count = streamParse(lines[i % line_count], args);
+        tokens += count;
+        for (int j = 0; j < count; ++j)
+        {
+            free(args[j]);
+        }
+    }
+    std::chrono::duration<double> stream_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        tokens += _parseCommandLine(lines[i % line_count], args, arena, quoted, COMMAND_MAX_ARGS);
+    }
+    std::chrono::duration<double> arena_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << "lines: " << iterations << " (" << tokens << " tokens)" << std::endl;
+    std::cout << "istringstream: " << (long)(iterations / stream_time.count()) << " lines/s" << std::endl;
+    std::cout << "arena:         " << (long)(iterations / arena_time.count()) << " lines/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,118 @@
+// One procmon table over many jobs against what watchproc does for a
+// single pid (open stat, uptime and statm, split the stat line into
+// strings), repeated for every pid.
+// usage: procmon_bench [processes] [rounds]
+// The processes are forked children sitting in pause(), killed at the end.
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Commands.h"
+
+class SyntheticCommand : public Command
+{
+public:
+    SyntheticCommand(const char *cmd_line) : Command(cmd_line) {}
+    void execute() override {}
+};
+
+static std::string readFile(const std::string &path)
+{
+    char buf[BUF_SIZE];
+    int fd = open(path.c_str(), O_RDONLY);
+    ssize_t bytes = fd == -1 ? -1 : read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    return bytes > 0 ? std::string(buf, bytes) : std::string();
+}
+
+// The per-pid work of the old watchproc
+static double oldWatchproc(pid_t pid)
+{
+    std::istringstream stat_stream(readFile("/proc/" + std::to_string(pid) + "/stat"));
+    std::vector<std::string> fields;
+    std::string token;
+    while (stat_stream >> token)
+    {
+        fields.push_back(token);
+    }
+    double uptime = std::stod(readFile("/proc/uptime"));
+    std::istringstream statm_stream(readFile("/proc/" + std::to_string(pid) + "/statm"));
+    long size, resident;
+    statm_stream >> size >> resident;
+    long hertz = sysconf(_SC_CLK_TCK);
+    return (std::stol(fields[13]) + std::stol(fields[14])) / (double)hertz / (uptime - std::stol(fields[21]) / hertz) +
+           resident;
+}
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    int processes = argc > 1 ? atoi(argv[1]) : 1000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+    SmallShell &smash = SmallShell::getInstance();
+    SyntheticCommand cmd("sleep 100");
+    std::vector<pid_t> children;
+    for (int i = 0; i < processes; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            pause();
+            _exit(0);
+        }
+        if (pid == -1)
+        {
+            perror("procmon_bench: fork");
+            break;
+        }
+        children.push_back(pid);
+        smash.jobs.addJob(&cmd, pid, false);
+    }
+    std::cout << "processes: " << children.size() << std::endl;
+
+    double checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+            checksum += oldWatchproc(children[i]);
+        }
+    }
+    std::cout << "watchproc per pid: " << msSince(start) / rounds << " ms per refresh (checksum " << checksum << ")"
+              << std::endl;
+
+    // keep the tables out of the report
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    ProcMonCommand procmon("procmon");
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        procmon.execute();
+    }
+    double elapsed = msSince(start);
+    std::cout << std::flush;
+    dup2(report_fd, STDOUT_FILENO);
+    std::cout << "procmon:           " << elapsed / rounds << " ms per refresh" << std::endl;
+
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        kill(children[i], SIGKILL);
+        waitpid(children[i], nullptr, 0);
+    }
+    return 0;
+}
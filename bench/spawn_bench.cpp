@@ -0,0 +1,43 @@
+// Launch rate of external commands for every smash spawn mode.
+// usage: spawn_bench [launches] [heap MB]
+// The heap argument makes the benchmark process look like a long-running
+// shell with a big address space, which is what makes fork() expensive.
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "../Commands.h"
+
+int main(int argc, char *argv[])
+{
+    int launches = argc > 1 ? atoi(argv[1]) : 2000;
+    size_t heap_mb = argc > 2 ? atoi(argv[2]) : 256;
+
+    // touch every page so fork has something to copy
+    std::vector<char> heap(heap_mb * 1024 * 1024);
+    memset(heap.data(), 1, heap.size());
+
+    char *true_args[] = {(char *)"true", nullptr};
+    SpawnMode modes[] = {SPAWN_FORK, SPAWN_VFORK, SPAWN_POSIX};
+
+    std::cout << "launches: " << launches << ", heap: " << heap_mb << " MB" << std::endl;
+    for (SpawnMode mode : modes)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < launches; ++i)
+        {
+            pid_t pid = spawnProcess("true", true_args, true, mode);
+            if (pid == -1)
+            {
+                return 1;
+            }
+            waitpid(pid, nullptr, 0);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << spawnModeName(mode) << ": " << (long)(launches / elapsed.count()) << " launches/s" << std::endl;
+    }
+    return 0;
+}
@@ -1,29 +1,426 @@
 #include <iostream>
 #include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include "signals.h"
 #include "Commands.h"
 
 using namespace std;
 
+volatile sig_atomic_t children_changed = 0;
+volatile sig_atomic_t ctrl_c_seen = 0;
+
+// epoll_event.data.u64 = tag << 32 | pid
+#define EVENT_STDIN (0ULL)
+#define EVENT_SIGNAL (1ULL)
+#define EVENT_CHILD (2ULL)
+
 void ctrlCHandler(int sig_num)
 {
+    ctrl_c_seen = 1;
     cout << "smash: got ctrl-C" << endl;
     SmallShell &smash = SmallShell::getInstance();
-    smash.jobs.removeFinishedJobs();
     pid_t fg_pid = smash.fg_pid;
     if (fg_pid == -1)
     {
         // if no process running, do nothing
         return;
     }
-    if (kill(fg_pid, SIGKILL) == -1)
+    // every foreground child leads its own process group, so this also takes
+    // down the other stages of a pipeline
+    if (kill(-fg_pid, SIGKILL) == -1 && kill(fg_pid, SIGKILL) == -1)
     {
         perror("smash error: kill failed");
     }
     else
     {
         cout << "smash: process " << fg_pid << " was killed" << endl;
-        smash.jobs.removeJobById(fg_pid);
+        smash.jobs.removeJobByPid(fg_pid);
     }
     smash.fg_pid = -1;
 }
+
+void sigchldHandler(int)
+{
+    // only note it here, the jobs list does the reaping outside of the handler
+    children_changed = 1;
+}
+
+EventLoop::EventLoop() : epoll_fd(-1), signal_fd(-1), stdin_watched(false)
+{
+    sigemptyset(&this->handled_mask);
+    sigaddset(&this->handled_mask, SIGINT);
+    sigaddset(&this->handled_mask, SIGCHLD);
+    sigprocmask(SIG_SETMASK, nullptr, &this->original_mask);
+}
+
+EventLoop::~EventLoop()
+{
+    if (this->signal_fd != -1)
+    {
+        close(this->signal_fd);
+    }
+    if (this->epoll_fd != -1)
+    {
+        close(this->epoll_fd);
+    }
+}
+
+void EventLoop::installHandlers()
+{
+    if (signal(SIGINT, ctrlCHandler) == SIG_ERR)
+    {
+        perror("smash error: failed to set ctrl-C handler");
+    }
+
+    struct sigaction chld_action;
+    memset(&chld_action, 0, sizeof(chld_action));
+    chld_action.sa_handler = sigchldHandler;
+    chld_action.sa_flags = SA_RESTART;
+    sigemptyset(&chld_action.sa_mask);
+    if (sigaction(SIGCHLD, &chld_action, nullptr) == -1)
+    {
+        perror("smash error: failed to set SIGCHLD handler");
+    }
+}
+
+void EventLoop::init()
+{
+    if (sigprocmask(SIG_BLOCK, &this->handled_mask, nullptr) == -1)
+    {
+        installHandlers();
+        return;
+    }
+
+    this->signal_fd = signalfd(-1, &this->handled_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_SIGNAL << 32;
+    if (this->signal_fd == -1 || this->epoll_fd == -1 || epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->signal_fd, &event) == -1)
+    {
+        resetInChild();
+        installHandlers();
+        return;
+    }
+
+    // regular files and /dev/null cannot be watched (EPERM), they are always readable anyway
+    event.data.u64 = EVENT_STDIN << 32;
+    this->stdin_watched = epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0;
+}
+
+void EventLoop::resetInChild()
+{
+    if (this->signal_fd != -1)
+    {
+        close(this->signal_fd);
+        this->signal_fd = -1;
+    }
+    if (this->epoll_fd != -1)
+    {
+        close(this->epoll_fd);
+        this->epoll_fd = -1;
+    }
+    this->stdin_watched = false;
+    sigprocmask(SIG_SETMASK, &this->original_mask, nullptr);
+}
+
+int EventLoop::watchChild(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    if (!active())
+    {
+        return -1;
+    }
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd == -1)
+    {
+        // old kernel, SIGCHLD still covers it
+        return -1;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = (EVENT_CHILD << 32) | (uint32_t)pid;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == -1)
+    {
+        close(pidfd);
+        return -1;
+    }
+    return pidfd;
+#else
+    return -1;
+#endif
+}
+
+bool EventLoop::handleSignals()
+{
+    bool interrupted = false;
+    struct signalfd_siginfo info;
+    while (read(this->signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo == SIGINT)
+        {
+            ctrlCHandler(SIGINT);
+            interrupted = true;
+        }
+        else if (info.ssi_signo == SIGCHLD)
+        {
+            children_changed = 1;
+        }
+    }
+    return interrupted;
+}
+
+bool EventLoop::sleepFor(int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    if (!active())
+    {
+        // Classic handlers: Ctrl-C is handled but cannot be told from SIGCHLD here
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+        {
+        }
+        return true;
+    }
+
+    while (true)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long remaining_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+        if (remaining_ms <= 0)
+        {
+            return true;
+        }
+        struct pollfd pfd = {this->signal_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, (int)remaining_ms);
+        if (ready == -1 && errno != EINTR)
+        {
+            perror("smash error: poll failed");
+            return true;
+        }
+        if (ready > 0 && handleSignals())
+        {
+            return false;
+        }
+    }
+}
+
+bool EventLoop::waitChildEvent()
+{
+    ctrl_c_seen = 0;
+    while (!children_changed)
+    {
+        if (!active())
+        {
+            // the classic handlers set the flags, look again every 10ms
+            struct timespec pause = {0, 10000000};
+            nanosleep(&pause, nullptr);
+            if (ctrl_c_seen)
+            {
+                return false;
+            }
+            continue;
+        }
+        struct pollfd pfd = {this->signal_fd, POLLIN, 0};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        {
+            perror("smash error: poll failed");
+            return true;
+        }
+        if (handleSignals())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int EventLoop::pollFds(struct pollfd *fds, int count, int timeout_ms)
+{
+    if (!active())
+    {
+        // the classic handlers cut poll short with EINTR
+        ctrl_c_seen = 0;
+        int ready;
+        while ((ready = poll(fds, count, timeout_ms)) == -1 && errno == EINTR && !ctrl_c_seen)
+        {
+            if (children_changed)
+            {
+                for (int i = 0; i < count; ++i)
+                {
+                    fds[i].revents = 0;
+                }
+                return 0;
+            }
+        }
+        return ctrl_c_seen ? -1 : ready;
+    }
+
+    // the signalfd rides along as the last entry
+    vector<struct pollfd> all(fds, fds + count);
+    struct pollfd signals = {this->signal_fd, POLLIN, 0};
+    all.push_back(signals);
+    int ready;
+    while ((ready = poll(all.data(), all.size(), timeout_ms)) == -1 && errno == EINTR)
+    {
+    }
+    if (ready == -1)
+    {
+        perror("smash error: poll failed");
+        return -1;
+    }
+    if (all.back().revents)
+    {
+        ready--;
+        if (handleSignals())
+        {
+            return -1;
+        }
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        fds[i].revents = all[i].revents;
+    }
+    return ready;
+}
+
+void EventLoop::dispatch(int timeout_ms)
+{
+    if (!active())
+    {
+        return;
+    }
+
+    struct epoll_event events[64];
+    int ready = epoll_wait(this->epoll_fd, events, 64, timeout_ms);
+    SmallShell &smash = SmallShell::getInstance();
+    for (int i = 0; i < ready; ++i)
+    {
+        uint64_t tag = events[i].data.u64 >> 32;
+        if (tag == EVENT_SIGNAL)
+        {
+            handleSignals();
+        }
+        else if (tag == EVENT_CHILD)
+        {
+            smash.jobs.reapJob((pid_t)(events[i].data.u64 & 0xffffffff));
+        }
+    }
+}
+
+pid_t EventLoop::waitChild(pid_t pid, int *status, int options, struct rusage *usage)
+{
+    if (!active())
+    {
+        pid_t res;
+        while ((res = wait4(pid, status, options, usage)) == -1 && errno == EINTR)
+        {
+        }
+        return res;
+    }
+
+    // SIGCHLD is blocked, so a child that changes state after waitpid() is
+    // still pending on the signalfd and wakes the poll below
+    while (true)
+    {
+        pid_t res = wait4(pid, status, options | WNOHANG, usage);
+        if (res != 0 || (options & WNOHANG))
+        {
+            return res;
+        }
+        struct pollfd pfd = {this->signal_fd, POLLIN, 0};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        {
+            perror("smash error: poll failed");
+            return -1;
+        }
+        handleSignals();
+    }
+}
+
+void EventLoop::run()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    string pending;
+    char buffer[BUF_SIZE];
+
+    cout << smash.getPrompt() << "> " << flush;
+    while (true)
+    {
+        if (this->stdin_watched)
+        {
+            // sleep until input, a signal or a job event shows up
+            dispatch(-1);
+        }
+        else
+        {
+            dispatch(0);
+        }
+        // Jobs reaped here may have freed jobq slots. Without pidfds nothing
+        // above reaps, so do it before starting more.
+        smash.jobs.removeFinishedJobs();
+        smash.jobs.startQueued();
+
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (this->stdin_watched && poll(&pfd, 1, 0) <= 0)
+        {
+            continue;
+        }
+        // read() restarts after SIGCHLD, poll() does not, so a queued command
+        // still starts while the prompt sits idle
+        if (!this->stdin_watched && smash.jobs.queueWaiting() && poll(&pfd, 1, -1) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (bytes_read == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            perror("smash error: read failed");
+            return;
+        }
+        if (bytes_read == 0)
+        {
+            // EOF, a last line without a newline still runs
+            if (!pending.empty())
+            {
+                smash.executeCommand(pending.c_str());
+            }
+            return;
+        }
+
+        pending.append(buffer, bytes_read);
+        size_t line_end;
+        while ((line_end = pending.find('\n')) != string::npos)
+        {
+            string cmd_line = pending.substr(0, line_end);
+            pending.erase(0, line_end + 1);
+            smash.executeCommand(cmd_line.c_str());
+            cout << smash.getPrompt() << "> " << flush;
+        }
+    }
+}
@@ -1,6 +1,87 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 
+#include <signal.h>
+#include <sys/types.h>
+
+struct rusage;
+struct pollfd;
+
+// Set whenever a child exits, stops or continues.
+// JobsList::removeFinishedJobs only reaps when it is set.
+extern volatile sig_atomic_t children_changed;
+
+// Set by ctrlCHandler. Without a signalfd it is how a builtin that waits
+// learns about Ctrl-C, clear it before waiting.
+extern volatile sig_atomic_t ctrl_c_seen;
+
 void ctrlCHandler(int sig_num);
 
+void sigchldHandler(int sig_num);
+
+// The interactive main loop. SIGINT and SIGCHLD are blocked and read from a
+// signalfd, every background job gets a pidfd, and all of them are watched
+// together with stdin through one epoll set. Nothing runs in signal context.
+// If the kernel does not give us signalfd/epoll we fall back to classic handlers.
+class EventLoop
+{
+public:
+    EventLoop();
+
+    ~EventLoop();
+
+    void init();
+
+    // Undoes init() in a forked child, before it runs smash code or execs
+    void resetInChild();
+
+    bool active() const
+    {
+        return this->epoll_fd != -1;
+    }
+
+    // The mask children should exec with (the one smash started with)
+    const sigset_t *childSigmask() const
+    {
+        return &this->original_mask;
+    }
+
+    // Returns a pidfd that is watched until it is closed, or -1 if pidfds are not supported
+    int watchChild(pid_t pid);
+
+    // Handles whatever is ready, waiting at most timeout_ms (-1 blocks)
+    void dispatch(int timeout_ms);
+
+    // waitpid() that keeps handling Ctrl-C and job events while it waits.
+    // With usage it is wait4() and fills in what the child used.
+    pid_t waitChild(pid_t pid, int *status, int options, struct rusage *usage = nullptr);
+
+    // Sleeps for timeout_ms while still handling signals, for builtins that
+    // run for a while. Returns false if Ctrl-C cut the sleep short.
+    bool sleepFor(int timeout_ms);
+
+    // Blocks until some child changes state (children_changed is set).
+    // Returns false if Ctrl-C came first.
+    bool waitChildEvent();
+
+    // poll() on fds that keeps handling signals while it waits. Returns how
+    // many of fds are ready, 0 early when a child changed state, or -1 on
+    // Ctrl-C or a poll error.
+    int pollFds(struct pollfd *fds, int count, int timeout_ms);
+
+    // Reads command lines from stdin and runs them until EOF
+    void run();
+
+private:
+    int epoll_fd;
+    int signal_fd;
+    bool stdin_watched;
+    sigset_t handled_mask;
+    sigset_t original_mask;
+
+    void installHandlers();
+    // Returns true if one of the signals was SIGINT
+    bool handleSignals();
+};
+
 #endif //SMASH__SIGNALS_H_
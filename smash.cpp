@@ -2,23 +2,54 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <string.h>
 #include "Commands.h"
 #include "signals.h"
 
 int main(int argc, char *argv[])
 {
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR)
+    SmallShell &smash = SmallShell::getInstance();
+    smash.events.init();
+
+    // smash -c "command" and smash script: no prompts, no rc file, exit at the end
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        if (argc == 2)
+        {
+            std::cerr << "smash error: -c: option requires an argument" << std::endl;
+            return 2;
+        }
+        smash.runScript(argv[2], strlen(argv[2]));
+        smash.jobs.releaseCgroups();
+        return smash.last_status;
+    }
+    if (argc > 1)
     {
-        perror("smash error: failed to set ctrl-C handler");
+        MappedFile script;
+        if (!script.open(argv[1]))
+        {
+            perror("smash error: open failed");
+            return 127;
+        }
+        smash.runScript(script.data, script.size);
+        smash.jobs.releaseCgroups();
+        return smash.last_status;
     }
 
-    SmallShell &smash = SmallShell::getInstance();
-    while (true)
+    // $SMASHRC picks another rc file, an empty one skips it
+    const char *rc_path = getenv("SMASHRC");
+    std::string default_rc_path;
+    if (!rc_path && getenv("HOME"))
+    {
+        default_rc_path = std::string(getenv("HOME")) + "/.smashrc";
+        rc_path = default_rc_path.c_str();
+    }
+    if (rc_path && *rc_path)
     {
-        std::cout << smash.getPrompt() << "> ";
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        smash.executeCommand(cmd_line.c_str());
+        smash.loadRcFile(rc_path);
     }
-    return 0;
-}
\ No newline at end of file
+
+    smash.events.run();
+    smash.jobs.releaseCgroups();
+    return smash.last_status;
+}